@@ -4,6 +4,7 @@
   * @date    :2021-04-19
   * @desc    :使用主、从两个有限状态机（fsm）读取和解析HTTP请求
   * 测试：curl -v "127.0.0.1:12345"
+  * 编译：g++ 8-3fsm_http.cc -o 8-3fsm_http（行扫描和头部字段查找与../http共用httpscan.h）
   * 状态机的算法流程：
   * 1、定义整个流程中可能出现的状态
   * 2、为每个状态规定一系列动作，使用switch驱动每个状态
@@ -18,6 +19,7 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <errno.h>
+#include "../http/httpscan.h"
 
 #define SERVERPORT "12345"
 #define BUFFER_SIZE 1024
@@ -51,40 +53,30 @@ static const char *szret[] = {"I get a correct result\n", "Something wrong\n"};
 //分析HTTP的行状态
 LINE_STATUS parse_line(char *buffer, int &checked_index, int &read_index)
 {
-    char temp;
-    //分析每个字节
-    for (; checked_index < read_index; checked_index++)
+    //向量化地跳过普通字符，直接定位到下一个回车符或换行符
+    checked_index = find_line_end(buffer + checked_index, buffer + read_index) - buffer;
+    if (checked_index == read_index)
     {
-        //获得当前要分析的字节
-        temp = buffer[checked_index];
-        //当前为回车符，说明可能读取了一个完整行
-        if (temp == '\r')
+        return LINE_OPEN;
+    }
+    //当前为回车符，说明可能读取了一个完整行
+    if (buffer[checked_index] == '\r')
+    {
+        if (checked_index + 1 == read_index)
         {
-            if (checked_index + 1 == read_index)
-            {
-                return LINE_OPEN;
-            }
-            //下一个字符为换行符，则说明读取到了一个完整行
-            else if (buffer[checked_index + 1] == '\n')
-            {
-                buffer[checked_index++] = '\0';
-                buffer[checked_index++] = '\0';
-                return LINE_OK;
-            }
+            return LINE_OPEN;
         }
-        //如果为换行符，则也有可能读取了一个完整行
-        else if (temp == '\n')
+        //下一个字符为换行符，则说明读取到了一个完整行
+        else if (buffer[checked_index + 1] == '\n')
         {
-            if ((checked_index > 1) && (buffer[checked_index + 1] == '\r'))
-            {
-                buffer[checked_index++] = '\0';
-                buffer[checked_index++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            buffer[checked_index++] = '\0';
+            buffer[checked_index++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
     }
-    return LINE_OPEN;
+    //单独的换行符，前面没有回车符
+    return LINE_BAD;
 }
 
 //解析HTTP请求的每行内容
@@ -142,10 +134,11 @@ HTTP_CODE parse_headers(char *temp)
     {
         return GET_REQUEST;
     }
-    //处理 HOST 头部字段
-    else if (strncasecmp(temp, "Host:", 5) == 0)
+    //处理 HOST 头部字段：按字段名长度分派查找
+    char *colon = strchr(temp, ':');
+    if (colon && lookup_header(temp, colon - temp) == HEADER_HOST)
     {
-        temp += 5;
+        temp = colon + 1;
         temp += strspn(temp, " ");
         printf("the request host is: %s\n", temp);
     }
@@ -3,6 +3,17 @@
   * @author  :zhl
   * @date    :2021-04-15
   * @desc    :
+  * 用法：./server [-p port] [-t threads] [-r loops] [--exec pool|inline] [--cache-files N] [--cache-mem MB] [--cache-small N] [--cache-ttl MS] [--io epoll|uring]
+  *       [--header-timeout S] [--body-timeout S] [--write-timeout S] [--keepalive-timeout S]
+  *       [--queue-depth N] [--queue-target MS] [--queue-interval MS] [--retry-after S] [--upload-dir DIR]
+  *       [--backlog N] [--tcp SPEC] [--root DIR] [--hosts FILE] [--drain-timeout S] [--trace LEVEL] [--trace-admin]
+  *       [--rate-limit N] [--rate-burst N] [--conn-limit N] [--limit-table N]
+  * -r 0（默认）为单Reactor模式：主线程accept并负责所有连接的读写，线程池只做解析；
+  * -r N为多Reactor模式：N个线程各自运行一个epoll循环，并各自持有一个SO_REUSEPORT监听socket，
+  * 由内核在N个监听socket之间分发新连接，连接固定在accept它的事件循环上；
+  * --io uring时事件循环换成io_uring实现，-r的含义不变，请求在事件循环线程中直接处理，不创建线程池；
+  * --exec inline时epoll后端也在事件循环线程中直接处理请求，不创建线程池；
+  * kill -USR2 <pid>平滑升级：启动同一路径上的新可执行文件并把监听socket交给它，旧进程处理完已有连接后退出
   */
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -12,16 +23,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <vector>
 #include "threadpool.h"
 #include "http.h"
-
-#define SERVERPORT "8888"
-#define MAX_FD 65535
-#define MAX_EVENT_NUMBER 10000
-
-//声明外部函数
-extern void addfd(int epfd, int fd, bool one_shot);
-extern void removefd(int epfd, int fd);
+#include "config.h"
+#include "eventloop.h"
+#include "uringloop.h"
+#include "filecache.h"
+#include "stats.h"
+#include "upgrade.h"
+#include "trace.h"
+#include "ratelimit.h"
 
 void addsig(int sig, void(handler)(int), bool restart = true)
 {
@@ -36,133 +48,356 @@ void addsig(int sig, void(handler)(int), bool restart = true)
   assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-void show_error(int cfd, const char *info)
+//创建非阻塞的监听socket，reuseport为true时多个socket可以绑定同一端口，backlog是已完成连接队列的长度，
+//tcp是监听socket的调优参数，accept得到的socket继承它们
+int create_listener(int port, bool reuseport, int backlog, const TcpProfile &tcp)
 {
-  printf("%s\n", info);
-  send(cfd, info, strlen(info), 0);
-  close(cfd);
+  struct sockaddr_in laddr;
+  int lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  assert(lfd >= 0);
+  laddr.sin_family = AF_INET;
+  laddr.sin_port = htons(port);
+  inet_pton(AF_INET, "0.0.0.0", &laddr.sin_addr);
+
+  if (reuseport)
+  {
+    int val = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+  }
+  //接收缓冲区的大小决定了握手时通告的窗口扩大因子，必须在listen之前设置
+  if (!apply_listener_options(lfd, tcp))
+  {
+    exit(1);
+  }
+
+  int ret = bind(lfd, (struct sockaddr *)&laddr, sizeof(laddr));
+  printf("lfd = %d\n", lfd);
+  assert(ret >= 0);
+  ret = listen(lfd, backlog);
+  assert(ret >= 0);
+  return lfd;
 }
 
-int main(int argc, char const *argv[])
-{
+//平滑升级启动时从旧进程继承的监听socket，创建事件循环时依次取用
+static std::vector<int> inherited;
+//所有事件循环的监听socket，下一次升级时交给新进程
+static std::vector<int> listeners;
 
+//取得一个监听socket：优先使用从旧进程继承的，不够时新建
+int open_listener(const ServerConfig &cfg, bool reuseport)
+{
   int lfd;
-  struct sockaddr_in laddr;
-  int ret;
-
-  //创建用于HTTP服务的线程池
-  threadpool<HTTPConn> *pool = nullptr;
-  try
+  if (!inherited.empty())
   {
-    pool = new threadpool<HTTPConn>;
+    lfd = inherited.front();
+    inherited.erase(inherited.begin());
+    //--tcp可能与旧进程不同，重新设置；已经listen的socket上新的设置只影响之后的连接
+    if (!apply_listener_options(lfd, cfg.tcp))
+    {
+      exit(1);
+    }
   }
-  catch (const std::exception &e)
+  else
+  {
+    lfd = create_listener(cfg.port, reuseport, cfg.backlog, cfg.tcp);
+  }
+  listeners.push_back(lfd);
+  return lfd;
+}
+
+//接收旧进程交来的监听socket，端口与-p不同的不使用（关闭后新建），最多取需要的个数
+void inherit(const ServerConfig &cfg, int loop_num)
+{
+  int fds[MAX_UPGRADE_LISTENERS];
+  int n = inherit_listeners(fds, loop_num);
+  if (n < 0)
   {
     exit(1);
   }
+  for (int i = 0; i < n; i++)
+  {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fds[i], (struct sockaddr *)&addr, &len) == 0 && ntohs(addr.sin_port) == cfg.port)
+    {
+      inherited.push_back(fds[i]);
+    }
+    else
+    {
+      printf("inherited listener %d is not on port %d, ignore\n", fds[i], cfg.port);
+      close(fds[i]);
+    }
+  }
+  if (n > 0)
+  {
+    printf("inherited %d listeners from old process\n", (int)inherited.size());
+  }
+}
 
-  //预先为每个可能的客户连接分配一个 HTTPConn 对象
-  auto users = new HTTPConn[MAX_FD];
-  assert(users);
+//向/_server/stats注册连接数和文件缓存的指标
+static long cache_stat(long FileCacheStats::*field)
+{
+  FileCacheStats stats;
+  FileCache::getInstance().get_stats(stats);
+  return stats.*field;
+}
 
-  //客户索引
-  int user_count = 0;
+void register_metrics()
+{
+  Stats::add_metric("connections", "Open client connections.", "gauge",
+                    []() { return (long)HTTPConn::m_user_count.load(); });
+  Stats::add_metric("filecache_hits_total", "File cache hits.", "counter",
+                    []() { return cache_stat(&FileCacheStats::hits); });
+  Stats::add_metric("filecache_misses_total", "File cache misses.", "counter",
+                    []() { return cache_stat(&FileCacheStats::misses); });
+  Stats::add_metric("filecache_evictions_total", "File cache LRU evictions.", "counter",
+                    []() { return cache_stat(&FileCacheStats::evictions); });
+  Stats::add_metric("filecache_resident_bytes", "Bytes of preassembled small-file responses kept in memory.", "gauge",
+                    []() { return cache_stat(&FileCacheStats::resident_bytes); });
+}
 
-  //忽略SIGPIPE信号
-  addsig(SIGPIPE, SIG_IGN);
+/*跟踪记录的管理接口只接受来自本机回环地址（127.0.0.0/8）的请求，不是时回复403*/
+static bool from_loopback(const HandlerRequest &req, HandlerResponse &resp)
+{
+  if ((ntohl(req.peer->sin_addr.s_addr) >> 24) == 127)
+  {
+    return true;
+  }
+  resp.status = 403;
+  resp.body = "only available from the loopback address\n";
+  return false;
+}
 
-  //socket配置
-  lfd = socket(AF_INET, SOCK_STREAM, 0);
-  assert(lfd >= 0);
-  laddr.sin_family = AF_INET;
-  laddr.sin_port = htons(atoi(SERVERPORT));
-  inet_pton(AF_INET, "0.0.0.0", &laddr.sin_addr);
+//注册动态请求的处理函数，其他路径由静态文件处理。trace_admin为true时注册跟踪记录的管理接口
+void register_handlers(bool trace_admin)
+{
+  //统计结果：默认Prometheus文本格式，?format=json输出JSON格式
+  HTTPConn::add_route(HTTPConn::GET, "/_server/stats", [](const HandlerRequest &req, HandlerResponse &resp) {
+    if (strcmp(req.query, "format=json") == 0)
+    {
+      resp.content_type = "application/json";
+      Stats::render_json(resp.body);
+    }
+    else
+    {
+      resp.content_type = "text/plain; version=0.0.4";
+      Stats::render_prometheus(resp.body);
+    }
+    resp.headers = "Cache-Control:no-store\r\n";
+    return true;
+  });
+  /*跟踪记录：GET导出所有线程的记录，PUT的消息体是新的运行时级别。
+  记录中有所有连接的请求路径，只在--trace-admin时注册，并且只接受本机的请求*/
+  if (!trace_admin)
+  {
+    return;
+  }
+  HTTPConn::add_route(HTTPConn::GET, "/_server/debug/trace", [](const HandlerRequest &req, HandlerResponse &resp) {
+    if (!from_loopback(req, resp))
+    {
+      return true;
+    }
+    Trace::dump([](void *ctx, const char *data, int len) { ((std::string *)ctx)->append(data, len); }, &resp.body);
+    resp.headers = "Cache-Control:no-store\r\n";
+    return true;
+  });
+  HTTPConn::add_route(HTTPConn::PUT, "/_server/debug/trace", [](const HandlerRequest &req, HandlerResponse &resp) {
+    if (!from_loopback(req, resp))
+    {
+      return true;
+    }
+    std::string name = req.body->substr(0, req.body->find_last_not_of(" \r\n") + 1);
+    int level = Trace::parse_level(name.c_str());
+    if (level < 0)
+    {
+      resp.status = 400;
+      resp.body = "level should be off, error, warn, info or debug\n";
+      return true;
+    }
+    Trace::set_level(level);
+    resp.status = 204;
+    return true;
+  });
+}
 
-  struct linger tmp = {1, 0};
-  setsockopt(lfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+//运行事件循环：单Reactor模式在主线程中运行唯一的事件循环，多Reactor模式每个事件循环一个线程
+template <typename LOOP>
+void run_loops(std::vector<LOOP *> &loops, bool multi)
+{
+  if (!multi)
+  {
+    loops[0]->loop();
+  }
+  else
+  {
+    for (size_t i = 0; i < loops.size(); i++)
+    {
+      if (!loops[i]->start())
+      {
+        printf("create event loop thread failure\n");
+        exit(1);
+      }
+    }
+    for (size_t i = 0; i < loops.size(); i++)
+    {
+      loops[i]->join();
+    }
+  }
+  for (size_t i = 0; i < loops.size(); i++)
+  {
+    delete loops[i];
+  }
+}
 
-  ret = bind(lfd, (struct sockaddr *)&laddr, sizeof(laddr));
-  printf("lfd = %d\n", lfd);
-  assert(ret >= 0);
-  ret = listen(lfd, 5);
-  assert(ret >= 0);
+/*事件循环已经建立：升级启动时通知旧进程停止accept，启动等待SIGUSR2的升级线程，然后运行事件循环*/
+template <typename LOOP>
+void serve(std::vector<LOOP *> &loops, char *argv[], const ServerConfig &cfg)
+{
+  notify_upgrade_ready();
+  auto stop_accept = [&loops]() {
+    for (size_t i = 0; i < loops.size(); i++)
+    {
+      loops[i]->stop_accept();
+    }
+  };
+  if (!start_upgrade_thread(argv, listeners, stop_accept, cfg.drain_timeout * 1000))
+  {
+    printf("create upgrade thread failure\n");
+    exit(1);
+  }
+  run_loops(loops, cfg.loop_num > 0);
+}
 
-  //初始化epoll模型
-  int epfd = epoll_create(1);
-  assert(epfd != -1);
-  epoll_event events[MAX_EVENT_NUMBER];
-  //监听lfd
-  addfd(epfd, lfd, false);
+int main(int argc, char *argv[])
+{
+  ServerConfig cfg;
+  if (!parse_args(argc, argv, cfg))
+  {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  //所有事件循环和工作线程共享的文件缓存
+  FileCache::getInstance().init(cfg.cache_files, cfg.cache_bytes, cfg.cache_small_file, cfg.cache_ttl_ms);
+
+  //连接各阶段的超时时间，由每个事件循环的时间轮检查
+  HTTPConn::set_timeouts(cfg.header_timeout * 1000, cfg.body_timeout * 1000,
+                         cfg.keepalive_timeout * 1000, cfg.write_timeout * 1000);
+  //过载时拒绝请求使用的503响应
+  HTTPConn::set_retry_after(cfg.retry_after);
+  //虚拟主机：默认网站来自--root和--upload-dir，配置文件中的网站按Host选择
+  static HostTable hosts;
+  if (!hosts.set_default(cfg.doc_root, cfg.upload_dir))
+  {
+    printf("open doc root %s or upload dir failure\n", cfg.doc_root);
+    exit(1);
+  }
+  if (cfg.hosts_file && !hosts.load(cfg.hosts_file))
+  {
+    exit(1);
+  }
+  HTTPConn::set_hosts(&hosts);
 
-  //初始化HTTP服务类的m_epollfd
-  HTTPConn::m_epollfd = epfd;
+  //新连接上需要单独设置的TCP选项
+  HTTPConn::set_tcp_profile(cfg.tcp);
 
-  while (1)
+  //按客户端地址的限制，都不限制时不建立限制表
+  if (cfg.rate_limit > 0 || cfg.conn_limit > 0)
   {
-    int n = epoll_wait(epfd, events, MAX_EVENT_NUMBER, -1);
-    if ((n < 0) && (errno != EINTR))
+    /*限制连接数时每个连接的地址都要占一项，表比MAX_FD个地址的3倍还小时候选桶容易占满、拒绝新地址，按这个下限扩大*/
+    if (cfg.conn_limit > 0 && cfg.limit_table < 3 * MAX_FD)
+    {
+      printf("--limit-table %d is too small for --conn-limit, using %d\n", cfg.limit_table, 3 * MAX_FD);
+      cfg.limit_table = 3 * MAX_FD;
+    }
+    try
     {
-      printf("epoll wait failure\n");
+      RateLimiter *limiter = new RateLimiter(cfg.rate_limit, cfg.rate_burst, cfg.conn_limit, cfg.limit_table);
+      HTTPConn::set_rate_limiter(limiter);
+    }
+    catch (const std::bad_alloc &e)
+    {
+      printf("allocate rate limit table failure\n");
       exit(1);
     }
-    for (size_t i = 0; i < n; i++)
+  }
+
+  //忽略SIGPIPE信号
+  addsig(SIGPIPE, SIG_IGN);
+  //跟踪记录的级别，崩溃时导出记录
+  Trace::set_level(cfg.trace_level);
+  Trace::install_crash_handler();
+  //SIGUSR2只由升级线程接收，必须在创建线程池和事件循环线程之前屏蔽
+  block_upgrade_signal();
+
+  register_metrics();
+  register_handlers(cfg.trace_admin);
+
+  int loop_num = cfg.loop_num == 0 ? 1 : cfg.loop_num;
+  inherit(cfg, loop_num);
+  if (cfg.io_backend == IO_URING)
+  {
+    std::vector<UringLoop *> uloops;
+    try
     {
-      int sockfd = events[i].data.fd;
-      //有新客户连接，分配一个线程
-      if (sockfd == lfd)
-      {
-        struct sockaddr_in raddr;
-        socklen_t raddr_len = sizeof(raddr);
-        int cfd = accept(sockfd, (struct sockaddr *)&raddr, &raddr_len);
-        if (cfd < 0)
-        {
-          fprintf(stdout, "errno is :%d\n", errno);
-          continue;
-        }
-        if (HTTPConn::m_user_count >= MAX_FD)
-        {
-          show_error(cfd, "Internal server busy");
-          continue;
-        }
-        //初始化客户连接
-        users[cfd].init(cfd, raddr);
-      }
-      //出错事件
-      else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-      {
-        //关闭客户连接
-        users[sockfd].close_conn(true);
-      }
-      //可读事件
-      else if (events[i].events & EPOLLIN)
+      for (int i = 0; i < loop_num; i++)
       {
-        /*根据读的结果，决定是将任务添加到线程池，还是关闭连接*/
-        if (users[sockfd].Read())
-        {
-          pool->append(users + sockfd); //数组首地址+cfd编号
-        }
-        else
-        {
-          users[sockfd].close_conn(true);
-        }
+        uloops.push_back(new UringLoop(open_listener(cfg, cfg.loop_num > 0)));
       }
-      //可写事件
-      else if (events[i].events & EPOLLOUT)
+    }
+    catch (const std::exception &e)
+    {
+      printf("io_uring is not supported by the kernel\n");
+      exit(1);
+    }
+    serve(uloops, argv, cfg);
+    return 0;
+  }
+
+  //创建用于HTTP服务的线程池，inline模式下不需要
+  threadpool<HTTPConn> *pool = nullptr;
+  if (cfg.exec_mode == EXEC_POOL)
+  {
+    try
+    {
+      pool = new threadpool<HTTPConn>(cfg.thread_num, cfg.queue_depth, cfg.queue_target_ms, cfg.queue_interval_ms);
+    }
+    catch (const std::exception &e)
+    {
+      exit(1);
+    }
+
+    Stats::add_metric("queue_depth", "Requests waiting in the threadpool queue.", "gauge",
+                      [pool]() { return (long)pool->size(); });
+    Stats::add_metric("requests_rejected_total", "Requests answered with 503 because the queue was full.", "counter",
+                      [pool]() { return pool->rejected(); });
+    Stats::add_metric("requests_shed_total", "Requests answered with 503 because they queued too long.", "counter",
+                      [pool]() { return pool->shed(); });
+  }
+
+  std::vector<EventLoop *> loops;
+  try
+  {
+    if (cfg.loop_num == 0)
+    {
+      //单Reactor：主线程运行唯一的事件循环
+      loops.push_back(new EventLoop(open_listener(cfg, false), pool));
+    }
+    else
+    {
+      //多Reactor：每个事件循环一个SO_REUSEPORT监听socket
+      for (int i = 0; i < cfg.loop_num; i++)
       {
-        /*根据写的结果，决定是否关闭连接*/
-        if (!users[sockfd].Write())
-        {
-          users[sockfd].close_conn(true);
-        }
-        else
-        {
-        }
+        loops.push_back(new EventLoop(open_listener(cfg, true), pool));
       }
     }
   }
-  close(epfd);
-  close(lfd);
-  delete[] users;
+  catch (const std::exception &e)
+  {
+    exit(1);
+  }
+
+  serve(loops, argv, cfg);
   delete pool;
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,214 @@
+/**
+  * @file    :bodydecoder.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :请求消息体的流式解码器：按Content-Length或chunked传输编码确定消息体的边界，
+  * 收到多少解码多少，解码出的数据一段一段交给调用者，不需要把整个消息体放在内存中
+*/
+
+#ifndef __BODYDECODER_H
+#define __BODYDECODER_H
+
+class BodyDecoder
+{
+public:
+    /*块大小的十六进制数字最多的位数，超过时认为长度溢出*/
+    static const int MAX_SIZE_DIGITS = 15;
+    /*块扩展和尾部字段的总长度上限，它们被跳过，不保存*/
+    static const int MAX_SKIP = 8192;
+
+    /*解码器的状态*/
+    enum STATE
+    {
+        BODY_LENGTH = 0, //按Content-Length接收消息体
+        CHUNK_SIZE,      //块大小
+        CHUNK_EXT,       //块扩展，跳过到行尾
+        CHUNK_SIZE_LF,   //块大小行结尾的'\n'
+        CHUNK_DATA,      //块数据
+        CHUNK_DATA_CR,   //块数据之后的"\r\n"
+        CHUNK_DATA_LF,
+        TRAILER,         //大小为0的块之后的尾部字段，以空行结束
+        TRAILER_LF,
+        BODY_DONE,
+        BODY_ERROR
+    };
+
+public:
+    BodyDecoder() { init_length(0); }
+
+    //消息体有length字节，length为0时立即结束
+    void init_length(long length)
+    {
+        m_state = length > 0 ? BODY_LENGTH : BODY_DONE;
+        m_remain = length;
+        m_received = 0;
+    }
+    //消息体使用chunked传输编码
+    void init_chunked()
+    {
+        m_state = CHUNK_SIZE;
+        m_remain = 0;
+        m_digits = 0;
+        m_skipped = 0;
+        m_received = 0;
+    }
+    bool done() const { return m_state == BODY_DONE; }
+    bool error() const { return m_state == BODY_ERROR; }
+    //已经解码出的消息体字节数
+    long received() const { return m_received; }
+
+    /*解码[data, data + len)，解码出的每一段数据调用sink(ptr, n)，sink返回false时进入出错状态。
+    返回消耗的字节数，消息体结束之后的数据（流水线中的下一个请求）不消耗；格式错误时返回-1*/
+    template <typename F>
+    int decode(const char *data, int len, F sink)
+    {
+        int pos = 0;
+        while (pos < len && m_state != BODY_DONE)
+        {
+            //消息体数据整段交出，只有块的边界逐字节解析
+            if (m_state == BODY_LENGTH || m_state == CHUNK_DATA)
+            {
+                int n = len - pos < m_remain ? len - pos : (int)m_remain;
+                if (!sink(data + pos, n))
+                {
+                    m_state = BODY_ERROR;
+                    return -1;
+                }
+                pos += n;
+                m_remain -= n;
+                m_received += n;
+                if (m_remain == 0)
+                {
+                    m_state = m_state == BODY_LENGTH ? BODY_DONE : CHUNK_DATA_CR;
+                }
+                continue;
+            }
+            if (!step(data[pos++]))
+            {
+                m_state = BODY_ERROR;
+                return -1;
+            }
+        }
+        return pos;
+    }
+
+private:
+    static int hex_value(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    //解析块边界的一个字节，格式错误时返回false
+    bool step(char c)
+    {
+        switch (m_state)
+        {
+        case CHUNK_SIZE:
+        {
+            int v = hex_value(c);
+            if (v >= 0)
+            {
+                if (++m_digits > MAX_SIZE_DIGITS)
+                {
+                    return false;
+                }
+                m_remain = m_remain * 16 + v;
+                return true;
+            }
+            if (m_digits == 0)
+            {
+                return false;
+            }
+            if (c == '\r')
+            {
+                m_state = CHUNK_SIZE_LF;
+                return true;
+            }
+            if (c == ';' || c == ' ' || c == '\t')
+            {
+                m_state = CHUNK_EXT;
+                return true;
+            }
+            return false;
+        }
+        case CHUNK_EXT:
+        {
+            if (c == '\r')
+            {
+                m_state = CHUNK_SIZE_LF;
+                return true;
+            }
+            return ++m_skipped <= MAX_SKIP;
+        }
+        case CHUNK_SIZE_LF:
+        {
+            if (c != '\n')
+            {
+                return false;
+            }
+            //大小为0的块是最后一块，之后是尾部字段
+            m_state = m_remain > 0 ? CHUNK_DATA : TRAILER;
+            m_line = 0;
+            return true;
+        }
+        case CHUNK_DATA_CR:
+        {
+            m_state = CHUNK_DATA_LF;
+            return c == '\r';
+        }
+        case CHUNK_DATA_LF:
+        {
+            m_state = CHUNK_SIZE;
+            m_digits = 0;
+            return c == '\n';
+        }
+        case TRAILER:
+        {
+            if (c == '\r')
+            {
+                m_state = TRAILER_LF;
+                return true;
+            }
+            m_line++;
+            return ++m_skipped <= MAX_SKIP;
+        }
+        case TRAILER_LF:
+        {
+            if (c != '\n')
+            {
+                return false;
+            }
+            //空行结束整个消息体
+            m_state = m_line == 0 ? BODY_DONE : TRAILER;
+            m_line = 0;
+            return true;
+        }
+        default:
+        {
+            return false;
+        }
+        }
+    }
+
+private:
+    STATE m_state;
+    long m_remain;   //当前块（或者整个定长消息体）还没有收到的字节数
+    int m_digits;    //块大小已经解析的位数
+    int m_line;      //当前尾部字段行的长度
+    int m_skipped;   //已经跳过的块扩展和尾部字段的字节数
+    long m_received;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/**
+  * @file    :buffer.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :buffer.h的源文件
+  */
+
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include "buffer.h"
+
+BufferPool::~BufferPool()
+{
+    for (int i = 0; i < CLASS_NUM; i++)
+    {
+        for (size_t j = 0; j < m_free[i].size(); j++)
+        {
+            delete[] m_free[i][j];
+        }
+    }
+}
+
+int BufferPool::size_class(int size)
+{
+    for (int cls = 0; cls < CLASS_NUM; cls++)
+    {
+        if (size <= block_size(cls))
+        {
+            return cls;
+        }
+    }
+    return -1;
+}
+
+char *BufferPool::get(int cls)
+{
+    char *block = nullptr;
+    m_lock[cls].lock();
+    if (!m_free[cls].empty())
+    {
+        block = m_free[cls].back();
+        m_free[cls].pop_back();
+    }
+    m_lock[cls].unlock();
+    if (!block)
+    {
+        block = new (std::nothrow) char[block_size(cls)];
+    }
+    return block;
+}
+
+void BufferPool::put(char *block, int cls)
+{
+    m_lock[cls].lock();
+    m_free[cls].push_back(block);
+    m_lock[cls].unlock();
+}
+
+bool FlatBuffer::reserve(int size, int used)
+{
+    if (size <= capacity())
+    {
+        return true;
+    }
+    int cls = BufferPool::size_class(size);
+    if (cls < 0)
+    {
+        return false;
+    }
+    char *block = BufferPool::getInstance().get(cls);
+    if (!block)
+    {
+        return false;
+    }
+    if (m_data)
+    {
+        memcpy(block, m_data, used);
+        BufferPool::getInstance().put(m_data, m_cls);
+    }
+    m_data = block;
+    m_cls = cls;
+    return true;
+}
+
+void FlatBuffer::shrink(int used, int cls)
+{
+    if (!m_data || m_cls <= cls || used > BufferPool::block_size(cls))
+    {
+        return;
+    }
+    char *block = BufferPool::getInstance().get(cls);
+    if (!block)
+    {
+        return;
+    }
+    memcpy(block, m_data, used);
+    BufferPool::getInstance().put(m_data, m_cls);
+    m_data = block;
+    m_cls = cls;
+}
+
+void FlatBuffer::release()
+{
+    if (m_data)
+    {
+        BufferPool::getInstance().put(m_data, m_cls);
+        m_data = nullptr;
+        m_cls = -1;
+    }
+}
+
+bool ChainBuffer::append(const char *data, int len)
+{
+    if (len > space())
+    {
+        return false;
+    }
+    int seg = segment_size();
+    while (len > 0)
+    {
+        int off = m_size % seg;
+        //最后一个内存块已满，再借用一个
+        if (off == 0 && m_size / seg == m_count)
+        {
+            char *block = BufferPool::getInstance().get(SEGMENT_CLASS);
+            if (!block)
+            {
+                return false;
+            }
+            m_segs[m_count++] = block;
+        }
+        int n = seg - off < len ? seg - off : len;
+        memcpy(m_segs[m_size / seg] + off, data, n);
+        m_size += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool ChainBuffer::appendv(const char *format, va_list args)
+{
+    /*响应头的一行通常不超过一个内存块，先格式化到栈上，再追加到链中，不需要关心跨块的问题*/
+    char line[1024];
+    int len = vsnprintf(line, sizeof(line), format, args);
+    if (len < 0 || len >= (int)sizeof(line))
+    {
+        return false;
+    }
+    return append(line, len);
+}
+
+int ChainBuffer::fill_iov(struct iovec *iov, int max, int offset, int len) const
+{
+    int seg = segment_size();
+    int count = 0;
+    while (len > 0 && count < max)
+    {
+        int off = offset % seg;
+        int n = seg - off < len ? seg - off : len;
+        iov[count].iov_base = m_segs[offset / seg] + off;
+        iov[count].iov_len = n;
+        count++;
+        offset += n;
+        len -= n;
+    }
+    return count;
+}
+
+void ChainBuffer::clear()
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        BufferPool::getInstance().put(m_segs[i], SEGMENT_CLASS);
+    }
+    m_count = 0;
+    m_size = 0;
+}
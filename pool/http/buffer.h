@@ -0,0 +1,103 @@
+/**
+  * @file    :buffer.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :连接使用的缓冲区，内存块都来自按大小分级的缓冲池
+  * FlatBuffer：连续的读缓冲区，平时只占一个小块，遇到大请求时换成更大的块，请求处理完后缩回小块
+  * ChainBuffer：由固定大小的内存块串起来的写缓冲区，可以不断追加，直接生成writev使用的iovec
+*/
+
+#ifndef __BUFFER_H
+#define __BUFFER_H
+
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <vector>
+#include "locker.h"
+
+/*缓冲池：级别cls的内存块大小为MIN_BLOCK << cls，每个级别各有一个空闲链表*/
+class BufferPool
+{
+public:
+    static const int MIN_BLOCK = 1024;
+    static const int CLASS_NUM = 7; //1KB ~ 64KB
+
+    //懒汉模式
+    static BufferPool &getInstance()
+    {
+        static BufferPool m_instance;
+        return m_instance;
+    }
+
+    static int block_size(int cls) { return MIN_BLOCK << cls; }
+    //能容纳size字节的最小级别，超过最大级别时返回-1
+    static int size_class(int size);
+
+    //取出一个cls级别的内存块
+    char *get(int cls);
+    //归还内存块
+    void put(char *block, int cls);
+
+private:
+    BufferPool() {}
+    ~BufferPool();
+
+private:
+    locker m_lock[CLASS_NUM];
+    std::vector<char *> m_free[CLASS_NUM];
+};
+
+/*连续的可增长缓冲区：使用者自己记录已用的字节数，扩容和缩容时保留前used个字节*/
+class FlatBuffer
+{
+public:
+    FlatBuffer() : m_data(nullptr), m_cls(-1) {}
+    ~FlatBuffer() { release(); }
+
+    char *data() const { return m_data; }
+    int capacity() const { return m_data ? BufferPool::block_size(m_cls) : 0; }
+
+    //确保容量至少为size，已有的前used个字节会被复制到新的内存块，超过最大级别时返回false
+    bool reserve(int size, int used);
+    //如果前used个字节放得进最小的块cls，则换回该级别的内存块
+    void shrink(int used, int cls);
+    //归还内存块
+    void release();
+
+private:
+    char *m_data;
+    int m_cls;
+};
+
+/*由固定大小的内存块组成的链式缓冲区，只在尾部追加，整体清空*/
+class ChainBuffer
+{
+public:
+    static const int SEGMENT_CLASS = 0; //每个内存块1KB
+    static const int MAX_SEGMENTS = 16; //最多16KB
+
+    ChainBuffer() : m_count(0), m_size(0) {}
+    ~ChainBuffer() { clear(); }
+
+    //已写入的总字节数
+    int size() const { return m_size; }
+    //还能写入的字节数
+    int space() const { return MAX_SEGMENTS * segment_size() - m_size; }
+    static int segment_size() { return BufferPool::block_size(SEGMENT_CLASS); }
+
+    //追加一段数据，空间不足时返回false
+    bool append(const char *data, int len);
+    //格式化后追加
+    bool appendv(const char *format, va_list args);
+    //生成覆盖[offset, offset+len)的iovec，最多max个，返回个数
+    int fill_iov(struct iovec *iov, int max, int offset, int len) const;
+    //归还所有内存块
+    void clear();
+
+private:
+    char *m_segs[MAX_SEGMENTS];
+    int m_count;
+    int m_size;
+};
+
+#endif
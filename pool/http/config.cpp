@@ -0,0 +1,252 @@
+/**
+  * @file    :config.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :config.h的源文件
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include "config.h"
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-p port] [-t threads] [-r loops] [options]\n", prog);
+    fprintf(stderr, "  -p port     监听端口，默认8888\n");
+    fprintf(stderr, "  -t threads  线程池的工作线程数，默认8\n");
+    fprintf(stderr, "  -r loops    事件循环线程数，0为单Reactor模式，默认0\n");
+    fprintf(stderr, "  --cache-files N   文件缓存最多缓存的文件数，默认1024\n");
+    fprintf(stderr, "  --cache-mem MB    小文件常驻内存副本的总预算，默认64MB\n");
+    fprintf(stderr, "  --cache-small N   小于N字节的文件常驻内存，默认65536\n");
+    fprintf(stderr, "  --cache-ttl MS    缓存项的有效期，到期后重新stat校验，默认2000ms\n");
+    fprintf(stderr, "  --io epoll|uring  I/O后端，默认epoll；uring不使用线程池，-t被忽略\n");
+    fprintf(stderr, "  --exec pool|inline  epoll后端由线程池解析请求，或者由事件循环线程自己处理（-t被忽略），默认pool\n");
+    fprintf(stderr, "  --header-timeout S     从请求开始到收到完整请求头的时限，默认10s，0为不限制\n");
+    fprintf(stderr, "  --body-timeout S       接收消息体时两次收到数据的最大间隔，默认30s\n");
+    fprintf(stderr, "  --write-timeout S      发送响应时两次发出数据的最大间隔，默认30s\n");
+    fprintf(stderr, "  --keepalive-timeout S  空闲长连接的保持时间，默认60s\n");
+    fprintf(stderr, "  --queue-depth N        线程池请求队列的最大长度，队列满时回复503，默认10000\n");
+    fprintf(stderr, "  --queue-target MS      持续过载时请求允许的排队时间，超过则回复503，默认5ms，0为不按排队时间丢弃\n");
+    fprintf(stderr, "  --queue-interval MS    判断持续过载的观察窗口，也是不过载时允许的排队时间，默认100ms\n");
+    fprintf(stderr, "  --retry-after S        503响应中Retry-After的值，默认1s\n");
+    fprintf(stderr, "  --backlog N            监听socket的连接队列长度，默认1024\n");
+    fprintf(stderr, "  --root DIR             默认网站的文档根目录，默认/var/www/html\n");
+    fprintf(stderr, "  --upload-dir DIR       允许PUT上传文件到DIR，消息体流式写入磁盘，默认不允许上传\n");
+    fprintf(stderr, "  --hosts FILE           虚拟主机配置，每行：主机名[,主机名...] 根目录 [upload=DIR] [cache-small=N] [cache-ttl=MS]\n");
+    fprintf(stderr, "                         [max-body=BYTES] [body-timeout=S]，\n");
+    fprintf(stderr, "                         Host不在表中的请求由默认网站（--root，或者主机名为default的一行）处理\n");
+    fprintf(stderr, "  --tcp SPEC             TCP调优参数：预设none|latency|throughput，或name=value，逗号分隔，后面的覆盖前面的，\n");
+    fprintf(stderr, "                         name为nodelay、defer-accept、fastopen、rcvbuf、sndbuf、notsent-lowat、busy-poll、quickack，\n");
+    fprintf(stderr, "                         默认latency\n");
+    fprintf(stderr, "  --drain-timeout S      收到SIGUSR2时启动新的可执行文件并把监听socket交给它，旧进程处理完已有连接后退出，\n");
+    fprintf(stderr, "                         最多等待S秒，默认30s\n");
+    fprintf(stderr, "  --trace LEVEL          跟踪记录的级别off|error|warn|info|debug，写入每个线程的环形缓冲区，默认off，\n");
+    fprintf(stderr, "                         崩溃时导出到标准错误\n");
+    fprintf(stderr, "  --trace-admin          注册GET /_server/debug/trace（导出记录）和PUT /_server/debug/trace（修改级别），只接受本机的请求\n");
+    fprintf(stderr, "  --rate-limit N         每个客户端IP地址每秒的请求数，超过时回复429，默认0（不限制）\n");
+    fprintf(stderr, "  --rate-burst N         每个地址允许的突发请求数（令牌桶容量），默认等于--rate-limit\n");
+    fprintf(stderr, "  --conn-limit N         每个客户端IP地址的并发连接数，超过时accept之后回复429并关闭，默认0（不限制）\n");
+    fprintf(stderr, "  --limit-table N        限制表最多同时记录的地址数（每3个地址64字节），默认196608，--conn-limit时至少是MAX_FD的3倍；\n");
+    fprintf(stderr, "                         --conn-limit时新地址的两个候选桶都已满（6个地址都有连接）会被拒绝，计入connections_saturated_total\n");
+}
+
+/*只有长选项的参数，取值不与短选项的字符冲突*/
+enum
+{
+    OPT_CACHE_FILES = 256,
+    OPT_CACHE_MEM,
+    OPT_CACHE_SMALL,
+    OPT_CACHE_TTL,
+    OPT_IO,
+    OPT_EXEC,
+    OPT_HEADER_TIMEOUT,
+    OPT_BODY_TIMEOUT,
+    OPT_WRITE_TIMEOUT,
+    OPT_KEEPALIVE_TIMEOUT,
+    OPT_QUEUE_DEPTH,
+    OPT_QUEUE_TARGET,
+    OPT_QUEUE_INTERVAL,
+    OPT_RETRY_AFTER,
+    OPT_UPLOAD_DIR,
+    OPT_BACKLOG,
+    OPT_TCP,
+    OPT_ROOT,
+    OPT_HOSTS,
+    OPT_DRAIN_TIMEOUT,
+    OPT_TRACE,
+    OPT_TRACE_ADMIN,
+    OPT_RATE_LIMIT,
+    OPT_RATE_BURST,
+    OPT_CONN_LIMIT,
+    OPT_LIMIT_TABLE
+};
+
+static const struct option long_options[] = {
+    {"cache-files", required_argument, NULL, OPT_CACHE_FILES},
+    {"cache-mem", required_argument, NULL, OPT_CACHE_MEM},
+    {"cache-small", required_argument, NULL, OPT_CACHE_SMALL},
+    {"cache-ttl", required_argument, NULL, OPT_CACHE_TTL},
+    {"io", required_argument, NULL, OPT_IO},
+    {"exec", required_argument, NULL, OPT_EXEC},
+    {"header-timeout", required_argument, NULL, OPT_HEADER_TIMEOUT},
+    {"body-timeout", required_argument, NULL, OPT_BODY_TIMEOUT},
+    {"write-timeout", required_argument, NULL, OPT_WRITE_TIMEOUT},
+    {"keepalive-timeout", required_argument, NULL, OPT_KEEPALIVE_TIMEOUT},
+    {"queue-depth", required_argument, NULL, OPT_QUEUE_DEPTH},
+    {"queue-target", required_argument, NULL, OPT_QUEUE_TARGET},
+    {"queue-interval", required_argument, NULL, OPT_QUEUE_INTERVAL},
+    {"retry-after", required_argument, NULL, OPT_RETRY_AFTER},
+    {"upload-dir", required_argument, NULL, OPT_UPLOAD_DIR},
+    {"backlog", required_argument, NULL, OPT_BACKLOG},
+    {"tcp", required_argument, NULL, OPT_TCP},
+    {"root", required_argument, NULL, OPT_ROOT},
+    {"hosts", required_argument, NULL, OPT_HOSTS},
+    {"drain-timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"trace-admin", no_argument, NULL, OPT_TRACE_ADMIN},
+    {"rate-limit", required_argument, NULL, OPT_RATE_LIMIT},
+    {"rate-burst", required_argument, NULL, OPT_RATE_BURST},
+    {"conn-limit", required_argument, NULL, OPT_CONN_LIMIT},
+    {"limit-table", required_argument, NULL, OPT_LIMIT_TABLE},
+    {NULL, 0, NULL, 0}};
+
+bool parse_args(int argc, char *argv[], ServerConfig &cfg)
+{
+    int c;
+    while ((c = getopt_long(argc, argv, "p:t:r:", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            cfg.port = atoi(optarg);
+            break;
+        case 't':
+            cfg.thread_num = atoi(optarg);
+            break;
+        case 'r':
+            cfg.loop_num = atoi(optarg);
+            break;
+        case OPT_CACHE_FILES:
+            cfg.cache_files = atoi(optarg);
+            break;
+        case OPT_CACHE_MEM:
+            cfg.cache_bytes = atol(optarg) << 20;
+            break;
+        case OPT_CACHE_SMALL:
+            cfg.cache_small_file = atoi(optarg);
+            break;
+        case OPT_CACHE_TTL:
+            cfg.cache_ttl_ms = atoi(optarg);
+            break;
+        case OPT_IO:
+            if (strcmp(optarg, "epoll") == 0)
+            {
+                cfg.io_backend = IO_EPOLL;
+            }
+            else if (strcmp(optarg, "uring") == 0)
+            {
+                cfg.io_backend = IO_URING;
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        case OPT_EXEC:
+            if (strcmp(optarg, "pool") == 0)
+            {
+                cfg.exec_mode = EXEC_POOL;
+            }
+            else if (strcmp(optarg, "inline") == 0)
+            {
+                cfg.exec_mode = EXEC_INLINE;
+            }
+            else
+            {
+                return false;
+            }
+            break;
+        case OPT_HEADER_TIMEOUT:
+            cfg.header_timeout = atoi(optarg);
+            break;
+        case OPT_BODY_TIMEOUT:
+            cfg.body_timeout = atoi(optarg);
+            break;
+        case OPT_WRITE_TIMEOUT:
+            cfg.write_timeout = atoi(optarg);
+            break;
+        case OPT_KEEPALIVE_TIMEOUT:
+            cfg.keepalive_timeout = atoi(optarg);
+            break;
+        case OPT_QUEUE_DEPTH:
+            cfg.queue_depth = atoi(optarg);
+            break;
+        case OPT_QUEUE_TARGET:
+            cfg.queue_target_ms = atoi(optarg);
+            break;
+        case OPT_QUEUE_INTERVAL:
+            cfg.queue_interval_ms = atoi(optarg);
+            break;
+        case OPT_RETRY_AFTER:
+            cfg.retry_after = atoi(optarg);
+            break;
+        case OPT_UPLOAD_DIR:
+            cfg.upload_dir = optarg;
+            break;
+        case OPT_BACKLOG:
+            cfg.backlog = atoi(optarg);
+            break;
+        case OPT_ROOT:
+            cfg.doc_root = optarg;
+            break;
+        case OPT_HOSTS:
+            cfg.hosts_file = optarg;
+            break;
+        case OPT_DRAIN_TIMEOUT:
+            cfg.drain_timeout = atoi(optarg);
+            break;
+        case OPT_TRACE:
+            cfg.trace_level = Trace::parse_level(optarg);
+            if (cfg.trace_level < 0)
+            {
+                return false;
+            }
+            break;
+        case OPT_TRACE_ADMIN:
+            cfg.trace_admin = true;
+            break;
+        case OPT_RATE_LIMIT:
+            cfg.rate_limit = atoi(optarg);
+            break;
+        case OPT_RATE_BURST:
+            cfg.rate_burst = atoi(optarg);
+            break;
+        case OPT_CONN_LIMIT:
+            cfg.conn_limit = atoi(optarg);
+            break;
+        case OPT_LIMIT_TABLE:
+            cfg.limit_table = atoi(optarg);
+            break;
+        case OPT_TCP:
+            if (!parse_tcp_profile(optarg, cfg.tcp))
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    if (cfg.port <= 0 || cfg.port > 65535 || cfg.thread_num <= 0 || cfg.loop_num < 0 ||
+        cfg.cache_files < 0 || cfg.cache_bytes < 0 || cfg.cache_small_file < 0 || cfg.cache_ttl_ms < 0 ||
+        cfg.header_timeout < 0 || cfg.body_timeout < 0 || cfg.write_timeout < 0 || cfg.keepalive_timeout < 0 ||
+        cfg.queue_depth <= 0 || cfg.queue_target_ms < 0 || cfg.queue_interval_ms < cfg.queue_target_ms || cfg.retry_after < 0 || cfg.backlog <= 0 ||
+        cfg.drain_timeout < 0 || cfg.rate_limit < 0 || cfg.rate_burst < 0 || cfg.conn_limit < 0 || cfg.limit_table <= 0)
+    {
+        return false;
+    }
+    return true;
+}
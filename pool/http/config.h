@@ -0,0 +1,98 @@
+/**
+  * @file    :config.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :Web服务器的启动参数，由命令行解析得到
+*/
+
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#include "tcptune.h"
+#include "trace.h"
+
+/*I/O后端*/
+enum IO_BACKEND
+{
+    IO_EPOLL = 0,
+    IO_URING
+};
+
+/*epoll后端的请求处理方式*/
+enum EXEC_MODE
+{
+    EXEC_POOL = 0, //事件循环读写，线程池解析请求
+    EXEC_INLINE    //事件循环线程自己解析请求，不使用线程池
+};
+
+struct ServerConfig
+{
+    /*监听端口*/
+    int port;
+    /*线程池中工作线程的数量*/
+    int thread_num;
+    /*事件循环线程的数量：0表示单Reactor模式（主线程负责accept和所有IO），
+    N>0表示每个线程一个事件循环，各自持有一个SO_REUSEPORT监听socket*/
+    int loop_num;
+    /*文件缓存：最多缓存的文件数、常驻内存副本的总预算（字节）、常驻内存的文件大小上限（字节）、缓存项有效期（毫秒）*/
+    int cache_files;
+    long cache_bytes;
+    int cache_small_file;
+    int cache_ttl_ms;
+    /*I/O后端：epoll加线程池，或者io_uring（请求在事件循环线程中直接处理）*/
+    IO_BACKEND io_backend;
+    /*epoll后端的请求处理方式：交给线程池，或者在事件循环线程中直接处理（连接只属于一个线程，不需要EPOLLONESHOT）*/
+    EXEC_MODE exec_mode;
+    /*连接各阶段的超时时间（秒），0表示不限制：等待完整请求头（从请求开始计时）、
+    接收消息体和发送响应（两次收发之间的间隔）、空闲的长连接*/
+    int header_timeout;
+    int body_timeout;
+    int write_timeout;
+    int keepalive_timeout;
+    /*过载保护：请求队列的最大长度；按排队时间丢弃请求的目标延迟和观察窗口（毫秒），目标延迟为0时不按排队时间丢弃；
+    拒绝请求时503响应中Retry-After的值（秒）*/
+    int queue_depth;
+    int queue_target_ms;
+    int queue_interval_ms;
+    int retry_after;
+    /*监听socket的已完成连接队列长度，超过/proc/sys/net/core/somaxconn时被内核截断*/
+    int backlog;
+    /*默认网站的文档根目录，以及PUT上传文件的目录（为空时不允许上传）*/
+    const char *doc_root;
+    const char *upload_dir;
+    /*虚拟主机配置文件，为空时只有默认网站*/
+    const char *hosts_file;
+    /*监听socket的TCP调优参数，accept得到的socket继承这些设置*/
+    TcpProfile tcp;
+    /*平滑升级（SIGUSR2）时，旧进程把监听socket交给新进程之后，等待已有连接处理完的最长时间（秒）*/
+    int drain_timeout;
+    /*跟踪记录的运行时级别，TRACE_OFF时不记录*/
+    int trace_level;
+    /*是否注册跟踪记录的管理接口（GET/PUT /_server/debug/trace，只接受本机的请求）*/
+    bool trace_admin;
+    /*按客户端IP地址的限制：每秒的请求数和令牌桶容量（0表示等于请求数），并发连接数，0表示不限制；
+    限制表最多同时记录的地址数*/
+    int rate_limit;
+    int rate_burst;
+    int conn_limit;
+    int limit_table;
+
+    ServerConfig()
+        : port(8888), thread_num(8), loop_num(0),
+          cache_files(1024), cache_bytes(64L << 20), cache_small_file(64 * 1024), cache_ttl_ms(2000),
+          io_backend(IO_EPOLL), exec_mode(EXEC_POOL),
+          header_timeout(10), body_timeout(30), write_timeout(30), keepalive_timeout(60),
+          queue_depth(10000), queue_target_ms(5), queue_interval_ms(100), retry_after(1),
+          backlog(1024), doc_root("/var/www/html"), upload_dir(nullptr), hosts_file(nullptr),
+          drain_timeout(30), trace_level(TRACE_OFF), trace_admin(false), rate_limit(0), rate_burst(0), conn_limit(0), limit_table(196608)
+    {
+        parse_tcp_profile("latency", tcp);
+    }
+};
+
+//解析命令行参数，失败时返回false
+bool parse_args(int argc, char *argv[], ServerConfig &cfg);
+//打印命令行用法
+void usage(const char *prog);
+
+#endif
@@ -0,0 +1,279 @@
+/**
+  * @file    :eventloop.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :eventloop.h的源文件
+  */
+
+#include "eventloop.h"
+
+//声明外部函数
+extern void addfd(int epfd, int fd, bool one_shot, void *ptr);
+extern void removefd(int epfd, int fd);
+
+static void show_error(int cfd, const char *info)
+{
+    TRACE(TRACE_WARN, Trace::CONN_REJECTED, cfd, HTTPConn::m_user_count.load(), info);
+    send(cfd, info, strlen(info), 0);
+    close(cfd);
+}
+
+EventLoop::EventLoop(int lfd, threadpool<HTTPConn> *pool)
+    : m_epollfd(-1), m_listenfd(lfd), m_wakefd(-1), m_pool(pool), m_thread(0), m_accept_pending(false)
+{
+    m_now = TimeWheel::now();
+    m_next_tick = m_now + m_wheel.slot_ms();
+    //平滑升级时fork出的新进程不继承epoll句柄
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epollfd == -1 || m_wakefd == -1)
+    {
+        throw std::exception();
+    }
+    //监听lfd，事件数据为空指针以区别于客户连接；eventfd的事件数据指向m_wakefd
+    addfd(m_epollfd, m_listenfd, false, NULL);
+    addfd(m_epollfd, m_wakefd, false, &m_wakefd);
+}
+
+EventLoop::~EventLoop()
+{
+    close(m_epollfd);
+    close(m_wakefd);
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+    }
+}
+
+void EventLoop::stop_accept()
+{
+    uint64_t one = 1;
+    if (write(m_wakefd, &one, sizeof(one)) == -1)
+    {
+        printf("wake event loop failure\n");
+    }
+}
+
+bool EventLoop::start()
+{
+    return pthread_create(&m_thread, NULL, worker, this) == 0;
+}
+
+void EventLoop::join()
+{
+    if (m_thread)
+    {
+        pthread_join(m_thread, NULL);
+    }
+}
+
+void *EventLoop::worker(void *arg)
+{
+    EventLoop *loop = (EventLoop *)arg;
+    loop->loop();
+    return loop;
+}
+
+void EventLoop::handle_accept()
+{
+    m_accept_pending = false;
+    for (int i = 0; i < ACCEPT_BATCH; i++)
+    {
+        struct sockaddr_in raddr;
+        socklen_t raddr_len = sizeof(raddr);
+        //新连接直接设置为非阻塞，不需要再用fcntl设置
+        int cfd = accept4(m_listenfd, (struct sockaddr *)&raddr, &raddr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0)
+        {
+            //队列已空；对方在accept之前就断开的连接跳过
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            //文件描述符用完等错误，剩下的连接留在队列中，等下一个新连接到达时再接受
+            TRACE(TRACE_WARN, Trace::ACCEPT_ERROR, m_listenfd, errno, nullptr);
+            return;
+        }
+        if (HTTPConn::m_user_count >= MAX_FD)
+        {
+            show_error(cfd, "Internal server busy");
+            continue;
+        }
+        //对方地址的连接数或请求速率超过限制
+        bool counted;
+        if (!HTTPConn::admit(cfd, raddr, m_now, counted))
+        {
+            continue;
+        }
+        //从对象池中取出连接对象并初始化，连接此后只在本事件循环中收发数据
+        HTTPConn *conn = HTTPConn::new_conn();
+        if (!conn)
+        {
+            HTTPConn::release_admit(raddr, counted);
+            show_error(cfd, "Internal server busy");
+            continue;
+        }
+        //有线程池时连接注册为EPOLLONESHOT，由事件循环和工作线程轮流处理
+        conn->init(cfd, raddr, m_epollfd, m_pool != nullptr, counted);
+        Stats::add(Stats::ACCEPTED);
+        conn->timer()->data = conn;
+        touch(conn);
+    }
+    //达到本轮的上限，边沿触发不会再通知队列中剩下的连接
+    m_accept_pending = true;
+}
+
+void EventLoop::handle_stop_accept()
+{
+    uint64_t value;
+    if (read(m_wakefd, &value, sizeof(value)) == -1 || m_listenfd == -1)
+    {
+        return;
+    }
+    /*监听socket的文件描述在新进程中仍然打开，只关闭文件描述符不会把它从epoll中删除，必须先EPOLL_CTL_DEL*/
+    removefd(m_epollfd, m_listenfd);
+    m_listenfd = -1;
+    m_accept_pending = false;
+    //按退出时的规则重新检查所有连接的定时器，空闲的长连接在DRAIN_IDLE_TIMEOUT之后关闭
+    std::vector<HTTPConn *> conns;
+    m_wheel.for_each([&conns](TimeWheelTimer *timer) { conns.push_back((HTTPConn *)timer->data); });
+    for (size_t i = 0; i < conns.size(); i++)
+    {
+        handle_timeout(conns[i]);
+    }
+}
+
+void EventLoop::touch(HTTPConn *conn)
+{
+    int timeout = conn->touch(m_now);
+    if (HTTPConn::min_timeout() > 0)
+    {
+        m_wheel.addClock(conn->timer(), timeout);
+    }
+}
+
+void EventLoop::close_conn(HTTPConn *conn)
+{
+    m_wheel.delClock(conn->timer());
+    conn->close_conn(true);
+}
+
+void EventLoop::expire()
+{
+    while (m_now >= m_next_tick)
+    {
+        m_wheel.tick([this](TimeWheelTimer *timer) { handle_timeout((HTTPConn *)timer->data); });
+        m_next_tick += m_wheel.slot_ms();
+    }
+}
+
+/*定时器到期时按连接实际所处的阶段检查，没有超时就按剩余时间重新设置*/
+void EventLoop::handle_timeout(HTTPConn *conn)
+{
+    int remain = HTTPConn::min_timeout();
+    //线程池中的连接不检查，处理完之后会重新注册事件
+    if (!conn->busy() && conn->expired(m_now, remain))
+    {
+        /*这里不直接关闭：工作线程可能刚清除m_busy，还没有重新注册事件。
+        shutdown之后事件循环会收到EPOLLHUP，按出错事件关闭连接*/
+        conn->shutdown_conn();
+        remain = HTTPConn::min_timeout();
+    }
+    m_wheel.addClock(conn->timer(), remain);
+}
+
+void EventLoop::loop()
+{
+    while (1)
+    {
+        //没有任何超时限制时不需要转动时间轮
+        int timeout = -1;
+        if (HTTPConn::min_timeout() > 0)
+        {
+            timeout = m_next_tick > m_now ? m_next_tick - m_now : 0;
+        }
+        //还有没接受完的连接时不等待
+        if (m_accept_pending)
+        {
+            timeout = 0;
+        }
+        int n = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, timeout);
+        Stats::add(Stats::SYS_EPOLL_WAIT);
+        if ((n < 0) && (errno != EINTR))
+        {
+            printf("epoll wait failure\n");
+            break;
+        }
+        m_now = TimeWheel::now();
+        long start = Stats::now();
+        for (int i = 0; i < n; i++)
+        {
+            HTTPConn *conn = (HTTPConn *)m_events[i].data.ptr;
+            //升级线程要求停止accept
+            if (m_events[i].data.ptr == &m_wakefd)
+            {
+                handle_stop_accept();
+            }
+            //有新客户连接
+            else if (!conn)
+            {
+                handle_accept();
+            }
+            //出错事件
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                //关闭客户连接
+                close_conn(conn);
+            }
+            //可读事件
+            else if (m_events[i].events & EPOLLIN)
+            {
+                /*根据读的结果，决定是将任务添加到线程池，还是关闭连接*/
+                touch(conn);
+                if (!conn->Read())
+                {
+                    close_conn(conn);
+                    continue;
+                }
+                //没有线程池：就地解析并发送，只在写不完时才改为等待EPOLLOUT
+                if (!m_pool)
+                {
+                    if (!conn->process_inline())
+                    {
+                        close_conn(conn);
+                    }
+                    continue;
+                }
+                conn->dispatch();
+                //请求队列已满：不排队，直接回复503
+                if (!m_pool->append(conn))
+                {
+                    conn->shed();
+                }
+            }
+            //可写事件
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                /*根据写的结果，决定是否关闭连接*/
+                touch(conn);
+                if (!conn->Write())
+                {
+                    close_conn(conn);
+                }
+            }
+        }
+        if (m_accept_pending)
+        {
+            handle_accept();
+        }
+        expire();
+        if (n > 0)
+        {
+            Stats::record(Stats::STAGE_LOOP, Stats::now() - start);
+        }
+    }
+}
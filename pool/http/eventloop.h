@@ -0,0 +1,73 @@
+/**
+  * @file    :eventloop.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :事件循环类，一个对象对应一个epoll实例和一个监听socket
+  * 单Reactor模式下只有一个事件循环，运行在主线程；
+  * 多Reactor模式下每个线程运行一个事件循环，连接固定在accept它的事件循环上。
+  * 每个事件循环有一个时间轮，连接有活动时重新设置定时器，超时的连接由事件循环关闭
+*/
+
+#ifndef __EVENTLOOP_H
+#define __EVENTLOOP_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "threadpool.h"
+#include "http.h"
+#include "timewheel.h"
+
+/*最大并发连接数，连接对象按需从对象池分配*/
+#define MAX_FD 65535
+#define MAX_EVENT_NUMBER 10000
+/*一次可读事件中最多接受的连接数，避免连接风暴时长时间不处理已有连接的事件*/
+#define ACCEPT_BATCH 64
+
+class EventLoop
+{
+public:
+    /*lfd是本事件循环独占的监听socket，pool是所有事件循环共享的线程池；
+    pool为空时（--exec inline）事件循环线程自己解析请求、发送响应，连接不在线程之间传递*/
+    EventLoop(int lfd, threadpool<HTTPConn> *pool);
+    ~EventLoop();
+
+    //创建一个线程运行事件循环
+    bool start();
+    //等待事件循环线程结束
+    void join();
+    //在当前线程中运行事件循环
+    void loop();
+    /*平滑升级：让事件循环停止accept并关闭空闲的长连接，已有的连接继续处理。
+    由升级线程调用，通过eventfd唤醒事件循环，实际的操作在事件循环线程中进行*/
+    void stop_accept();
+
+private:
+    static void *worker(void *arg);
+    /*接受新连接，并注册到本事件循环的epoll中。监听socket是边沿触发的，一次接受到EAGAIN为止；
+    达到ACCEPT_BATCH时设置m_accept_pending，处理完本轮的其他事件后继续接受*/
+    void handle_accept();
+    //eventfd可读：从epoll中删除并关闭监听socket（socket已经交给新进程，这里只是关闭本进程中的引用），检查所有连接
+    void handle_stop_accept();
+    //连接上有活动：记录活动时间，重新设置定时器
+    void touch(HTTPConn *conn);
+    //关闭连接，同时删除它的定时器
+    void close_conn(HTTPConn *conn);
+    //转动时间轮，处理到期的定时器
+    void expire();
+    void handle_timeout(HTTPConn *conn);
+
+private:
+    int m_epollfd;                          //本事件循环的epoll句柄
+    int m_listenfd;                         //本事件循环的监听socket，停止accept之后为-1
+    int m_wakefd;                           //升级线程唤醒事件循环的eventfd
+    threadpool<HTTPConn> *m_pool;           //线程池
+    pthread_t m_thread;                     //运行事件循环的线程
+    epoll_event m_events[MAX_EVENT_NUMBER]; //就绪事件
+    TimeWheel m_wheel;                      //本事件循环所有连接的定时器
+    long m_now;                             //本轮循环的当前时间（毫秒）
+    long m_next_tick;                       //时间轮下一次转动的时间
+    bool m_accept_pending;                  //监听socket的队列中可能还有未接受的连接
+};
+
+#endif
@@ -0,0 +1,332 @@
+/**
+  * @file    :filecache.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :filecache.h的源文件
+  */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include "filecache.h"
+
+//单调时钟的毫秒数
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+FileEntry::~FileEntry()
+{
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    //常驻内存的副本是完整响应的一部分
+    delete[] (response ? response : data);
+}
+
+FileCache::FileCache()
+    : m_resident_bytes(0), m_max_files(1024), m_max_bytes(64L << 20), m_small_file(64 * 1024), m_ttl_ms(2000),
+      m_hits(0), m_misses(0), m_revalidations(0), m_invalidations(0), m_evictions(0), m_resident_hits(0)
+{
+}
+
+void FileCache::init(int max_files, long max_bytes, int small_file, int ttl_ms)
+{
+    m_lock.lock();
+    m_max_files = max_files;
+    m_max_bytes = max_bytes;
+    m_small_file = small_file;
+    m_ttl_ms = ttl_ms;
+    evict_locked();
+    m_lock.unlock();
+}
+
+FileEntryPtr FileCache::acquire(const char *path, int &err, int small_file, int ttl_ms)
+{
+    if (small_file < 0)
+    {
+        small_file = m_small_file;
+    }
+    if (ttl_ms < 0)
+    {
+        ttl_ms = m_ttl_ms;
+    }
+    FileEntryPtr entry;
+    m_lock.lock();
+    auto it = m_table.find(path);
+    if (it != m_table.end())
+    {
+        entry = *it->second;
+        //移动到LRU表头
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+    }
+    m_lock.unlock();
+
+    if (entry)
+    {
+        long now = now_ms();
+        if (now - entry->checked.load(std::memory_order_relaxed) < ttl_ms || revalidate(entry, now))
+        {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            if (entry->data)
+            {
+                m_resident_hits.fetch_add(1, std::memory_order_relaxed);
+            }
+            return entry;
+        }
+        //文件已经变化，删除旧的缓存项后重新加载
+        m_invalidations.fetch_add(1, std::memory_order_relaxed);
+        m_lock.lock();
+        remove_locked(entry);
+        m_lock.unlock();
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    entry = load(path, err, small_file);
+    if (entry)
+    {
+        insert(entry);
+    }
+    return entry;
+}
+
+const char *const encoding_names[ENCODING_NUM] = {"br", "gzip"};
+/*预压缩副本的文件名后缀，下标是CONTENT_ENCODING*/
+static const char *const encoding_suffix[ENCODING_NUM] = {".br", ".gz"};
+
+long FileEntry::resident_size() const
+{
+    long size = response_len;
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        if (encoded[i])
+        {
+            size += encoded[i]->response_len;
+        }
+    }
+    return size;
+}
+
+//两次stat的结果是否是同一个没有变化的文件
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec && a.st_mode == b.st_mode;
+}
+
+/*stat原文件path的预压缩副本，副本可用时返回true：是可读的普通文件，并且不比原文件旧
+（修改原文件之后没有重新生成的副本内容已经过时，不能使用）*/
+static bool stat_encoded(const char *path, int encoding, const struct stat &st, std::string &name, struct stat &est)
+{
+    name = path;
+    name += encoding_suffix[encoding];
+    if (stat(name.c_str(), &est) < 0 || !S_ISREG(est.st_mode) || !(est.st_mode & S_IROTH))
+    {
+        return false;
+    }
+    return est.st_mtim.tv_sec > st.st_mtim.tv_sec ||
+           (est.st_mtim.tv_sec == st.st_mtim.tv_sec && est.st_mtim.tv_nsec >= st.st_mtim.tv_nsec);
+}
+
+bool FileCache::revalidate(const FileEntryPtr &entry, long now)
+{
+    m_revalidations.fetch_add(1, std::memory_order_relaxed);
+    struct stat st;
+    if (stat(entry->path.c_str(), &st) < 0 || !same_file(st, entry->st))
+    {
+        return false;
+    }
+    /*预压缩副本出现、消失或者被重新生成，都需要重新加载整个缓存项*/
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        std::string name;
+        struct stat est;
+        bool usable = stat_encoded(entry->path.c_str(), i, st, name, est);
+        if (usable != (bool)entry->encoded[i] || (usable && !same_file(est, entry->encoded[i]->st)))
+        {
+            return false;
+        }
+    }
+    entry->checked.store(now, std::memory_order_relaxed);
+    return true;
+}
+
+FileEntryPtr FileCache::load(const char *path, int &err, int small_file)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+    {
+        err = (errno == EACCES) ? EACCES : ENOENT;
+        return FileEntryPtr();
+    }
+    if (!(st.st_mode & S_IROTH))
+    {
+        err = EACCES;
+        return FileEntryPtr();
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        err = EISDIR;
+        return FileEntryPtr();
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        err = EACCES;
+        return FileEntryPtr();
+    }
+
+    FileEntryPtr entry = std::make_shared<FileEntry>();
+    entry->path = path;
+    entry->fd = fd;
+    entry->st = st;
+    entry->checked.store(now_ms(), std::memory_order_relaxed);
+
+    /*有预压缩副本时，原文件的响应也随客户端的Accept-Encoding而变，需要Vary*/
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        entry->encoded[i] = load_encoded(path, st, i, small_file);
+        if (entry->encoded[i])
+        {
+            entry->encoding = "Vary:Accept-Encoding\r\n";
+        }
+    }
+    build(entry.get(), small_file);
+    return entry;
+}
+
+FileEntryPtr FileCache::load_encoded(const char *path, const struct stat &st, int encoding, int small_file)
+{
+    std::string name;
+    struct stat est;
+    if (!stat_encoded(path, encoding, st, name, est))
+    {
+        return FileEntryPtr();
+    }
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return FileEntryPtr();
+    }
+    FileEntryPtr entry = std::make_shared<FileEntry>();
+    entry->path = name;
+    entry->fd = fd;
+    entry->st = est;
+    entry->encoding = std::string("Content-Encoding:") + encoding_names[encoding] + "\r\nVary:Accept-Encoding\r\n";
+    build(entry.get(), small_file);
+    return entry;
+}
+
+void FileCache::build(FileEntry *entry, int small_file)
+{
+    const struct stat &st = entry->st;
+    int fd = entry->fd;
+
+    /*校验器只依赖文件属性，文件变化时缓存项失效，重新加载时随之更新。
+    预压缩副本是另一个文件，校验器与原文件不同，条件请求和Range不会把两种表示混在一起*/
+    char buf[512];
+    snprintf(buf, sizeof(buf), "\"%lx.%lx-%lx\"", (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec, (long)st.st_size);
+    entry->etag = buf;
+    entry->mtime = st.st_mtim.tv_sec;
+    struct tm tm;
+    gmtime_r(&entry->mtime, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    entry->last_modified = buf;
+
+    snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nAccept-Ranges:bytes\r\nETag:%s\r\nLast-Modified:%s\r\n%sContent-Length:%ld\r\n",
+             entry->etag.c_str(), entry->last_modified.c_str(), entry->encoding.c_str(), (long)st.st_size);
+    entry->header = buf;
+
+    /*小文件读入内存，紧接在预先拼好的完整响应头之后，之后的请求直接发送内存中的副本，不再需要mmap*/
+    if (st.st_size > 0 && st.st_size < small_file)
+    {
+        static const char keep_alive[] = "Connection:keep-alive\r\n\r\n";
+        int header_len = entry->header.size() + sizeof(keep_alive) - 1;
+        char *response = new char[header_len + st.st_size];
+        memcpy(response, entry->header.data(), entry->header.size());
+        memcpy(response + entry->header.size(), keep_alive, sizeof(keep_alive) - 1);
+        char *data = response + header_len;
+        off_t done = 0;
+        while (done < st.st_size)
+        {
+            ssize_t n = pread(fd, data + done, st.st_size - done, done);
+            if (n <= 0)
+            {
+                break;
+            }
+            done += n;
+        }
+        //文件在读取过程中被截断，则不保留副本，退回sendfile
+        if (done == st.st_size)
+        {
+            entry->response = response;
+            entry->response_len = header_len + st.st_size;
+            entry->data = data;
+        }
+        else
+        {
+            delete[] response;
+        }
+    }
+}
+
+void FileCache::insert(const FileEntryPtr &entry)
+{
+    m_lock.lock();
+    auto it = m_table.find(entry->path);
+    if (it != m_table.end())
+    {
+        remove_locked(*it->second);
+    }
+    m_lru.push_front(entry);
+    m_table[entry->path] = m_lru.begin();
+    m_resident_bytes += entry->resident_size();
+    evict_locked();
+    m_lock.unlock();
+}
+
+void FileCache::remove_locked(const FileEntryPtr &entry)
+{
+    auto it = m_table.find(entry->path);
+    //其他线程可能已经替换了同路径的缓存项
+    if (it == m_table.end() || *it->second != entry)
+    {
+        return;
+    }
+    m_resident_bytes -= entry->resident_size();
+    m_lru.erase(it->second);
+    m_table.erase(it);
+}
+
+void FileCache::evict_locked()
+{
+    while (!m_lru.empty() && ((int)m_table.size() > m_max_files || m_resident_bytes > m_max_bytes))
+    {
+        FileEntryPtr victim = m_lru.back();
+        remove_locked(victim);
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void FileCache::get_stats(FileCacheStats &stats)
+{
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+    stats.revalidations = m_revalidations.load(std::memory_order_relaxed);
+    stats.invalidations = m_invalidations.load(std::memory_order_relaxed);
+    stats.evictions = m_evictions.load(std::memory_order_relaxed);
+    stats.resident_hits = m_resident_hits.load(std::memory_order_relaxed);
+    /*不使用缓存时每个请求需要stat+open+close，小文件另外还有mmap+munmap；TTL到期的校验花费一次stat*/
+    stats.syscalls_saved = stats.resident_hits * 5 + (stats.hits - stats.resident_hits) * 3 - stats.revalidations;
+    m_lock.lock();
+    stats.files = m_table.size();
+    stats.resident_bytes = m_resident_bytes;
+    m_lock.unlock();
+}
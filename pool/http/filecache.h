@@ -0,0 +1,138 @@
+/**
+  * @file    :filecache.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :进程内共享的文件缓存，以文件路径为键，缓存打开的文件描述符、文件属性、
+  * 校验器（ETag和Last-Modified）、预先生成的响应头，小文件常驻内存的副本，以及同目录下预压缩的副本（.br、.gz）。
+  * 缓存项在TTL到期后通过stat重新校验，文件变化则失效；超出文件数或内存预算时按LRU淘汰
+*/
+
+#ifndef __FILECACHE_H
+#define __FILECACHE_H
+
+#include <sys/stat.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include "locker.h"
+
+/*预压缩副本的内容编码，按优先顺序排列：客户端同时接受多种编码时选择靠前的*/
+enum CONTENT_ENCODING
+{
+    ENCODING_BR = 0,
+    ENCODING_GZIP,
+    ENCODING_NUM
+};
+/*Content-Encoding的值，下标是CONTENT_ENCODING*/
+extern const char *const encoding_names[ENCODING_NUM];
+
+struct FileEntry;
+typedef std::shared_ptr<FileEntry> FileEntryPtr;
+
+/*缓存项：被淘汰或失效后，正在使用它的连接仍然持有引用，直到最后一个引用释放时才关闭文件*/
+struct FileEntry
+{
+    FileEntry() : fd(-1), mtime(0), data(nullptr), response(nullptr), response_len(0), checked(0) {}
+    ~FileEntry();
+
+    std::string path;           //文件的完整路径
+    int fd;                     //只读打开的文件描述符，sendfile使用显式偏移，多个连接可以共享
+    struct stat st;             //文件属性
+    std::string etag;           //强校验器，由修改时间（纳秒）和文件大小生成，带双引号
+    std::string last_modified;  //修改时间的HTTP-date格式
+    time_t mtime;               //修改时间（秒），If-Modified-Since与它比较
+    std::string encoding;       //预压缩副本的Content-Encoding和Vary头部字段；有预压缩副本的原文件只有Vary；其他为空
+    std::string header;         //预先生成的响应头：状态行、Accept-Ranges、校验器、encoding和Content-Length
+    char *data;                 //小文件常驻内存的副本，没有时为nullptr
+    /*常驻内存的小文件在内存中是一个完整的200响应：响应头（带Connection:keep-alive和空行）之后紧跟文件内容，
+    data指向其中的文件内容。长连接上的请求直接发送整块内存，不需要逐个请求生成响应头*/
+    char *response;
+    int response_len;
+    std::atomic<long> checked;  //上次确认文件没有变化的时间（毫秒）
+    /*同目录下的预压缩副本path.br和path.gz，不存在或者比原文件旧时为空。
+    副本随原文件一起校验和淘汰，不单独占用缓存的位置，但各自持有一个文件描述符*/
+    FileEntryPtr encoded[ENCODING_NUM];
+
+    //原文件和预压缩副本常驻内存的总字节数
+    long resident_size() const;
+};
+
+/*缓存的统计信息*/
+struct FileCacheStats
+{
+    long hits;           //命中次数
+    long misses;         //未命中次数，需要stat+open
+    long revalidations;  //TTL到期后重新stat的次数
+    long invalidations;  //文件发生变化导致缓存项失效的次数
+    long evictions;      //超出预算被LRU淘汰的次数
+    long resident_hits;  //命中常驻内存小文件的次数
+    long syscalls_saved; //命中节省的系统调用次数
+    int files;           //当前缓存的文件数
+    long resident_bytes; //当前常驻内存的字节数
+};
+
+class FileCache
+{
+public:
+    //懒汉模式
+    static FileCache &getInstance()
+    {
+        static FileCache m_instance;
+        return m_instance;
+    }
+
+    /*max_files是最多缓存的文件数（即占用的文件描述符数），max_bytes是常驻内存副本的总预算，
+    small_file是常驻内存的文件大小上限，ttl_ms是缓存项的有效期*/
+    void init(int max_files, long max_bytes, int small_file, int ttl_ms);
+
+    /*查找path对应的缓存项，未命中时打开文件并加入缓存。
+    失败时返回空指针，err为错误码：ENOENT不存在，EACCES没有读权限，EISDIR是目录。
+    small_file和ttl_ms为-1时使用init设置的值，否则覆盖之（虚拟主机各自的缓存策略）*/
+    FileEntryPtr acquire(const char *path, int &err, int small_file = -1, int ttl_ms = -1);
+
+    //获取统计信息
+    void get_stats(FileCacheStats &stats);
+
+private:
+    FileCache();
+    ~FileCache() {}
+
+    //打开文件并生成缓存项
+    FileEntryPtr load(const char *path, int &err, int small_file);
+    //打开原文件path的预压缩副本，st是原文件的属性，副本不可用时返回空指针
+    FileEntryPtr load_encoded(const char *path, const struct stat &st, int encoding, int small_file);
+    //生成缓存项的校验器、响应头，小于small_file字节的文件另外生成常驻内存的副本
+    void build(FileEntry *entry, int small_file);
+    //TTL到期后重新stat，文件没有变化返回true
+    bool revalidate(const FileEntryPtr &entry, long now);
+    //插入新的缓存项，替换同路径的旧项
+    void insert(const FileEntryPtr &entry);
+    //从缓存中删除entry，调用者需持有锁
+    void remove_locked(const FileEntryPtr &entry);
+    //超出预算时淘汰最久未使用的缓存项，调用者需持有锁
+    void evict_locked();
+
+private:
+    typedef std::list<FileEntryPtr> LRUList;
+
+    locker m_lock;                                             //保护m_lru和m_table
+    LRUList m_lru;                                             //表头是最近使用的缓存项
+    std::unordered_map<std::string, LRUList::iterator> m_table; //路径到LRU节点的索引
+    long m_resident_bytes;                                     //常驻内存的完整响应的总字节数
+
+    int m_max_files;
+    long m_max_bytes;
+    int m_small_file;
+    int m_ttl_ms;
+
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_revalidations;
+    std::atomic<long> m_invalidations;
+    std::atomic<long> m_evictions;
+    std::atomic<long> m_resident_hits;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/**
+  * @file    :handler.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :动态请求的处理函数接口。处理函数按请求方法和路径模式注册到路由表（router.h），
+  * 匹配的请求不再查找文件，而是调用处理函数生成响应；没有匹配的请求仍然由静态文件处理。
+  * 应用的路由按Host注册在各自网站的路由表中，只遮住这个网站的同名文件；保留的前缀/_server/（HTTPConn::ROUTE_PREFIX）
+  * 之下是服务器自带的统计和跟踪接口，所有网站共享，网站的这个目录不会被访问到。
+  * 处理函数在解析请求的线程中调用：epoll后端默认是线程池的工作线程，--exec inline和io_uring后端是事件循环线程，
+  * 所以处理函数不能长时间阻塞，多个线程会同时调用同一个处理函数
+*/
+
+#ifndef __HANDLER_H
+#define __HANDLER_H
+
+#include <string>
+#include <functional>
+#include <netinet/in.h>
+#include "router.h"
+
+/*处理函数看到的请求，其中的指针只在处理函数返回之前有效*/
+struct HandlerRequest
+{
+    int method;                //HTTPConn::METHOD
+    const char *path;          //请求的路径，不含'?'及之后的查询字符串，不以'\0'结尾
+    int path_len;
+    const char *query;         //'?'之后的查询字符串，没有时为空串
+    const char *host;          //Host头部字段的值，没有时为空
+    const sockaddr_in *peer;   //客户端的地址
+    const RouteParams *params; //路径模式中的变量匹配到的部分
+    const std::string *body;   //消息体，没有时为空串
+
+    //取出名为name的变量的值，没有这个变量时返回false
+    bool param(const char *name, std::string &value) const
+    {
+        const RouteParams::Param *p = params->find(name);
+        if (!p)
+        {
+            return false;
+        }
+        value.assign(path + p->offset, p->len);
+        return true;
+    }
+};
+
+/*处理函数生成的响应。状态行、Content-Type、Content-Length和Connection由服务器生成，
+headers是额外的头部字段，每个以"\r\n"结尾*/
+struct HandlerResponse
+{
+    HandlerResponse() : status(200), content_type("text/plain") {}
+
+    int status;
+    std::string content_type;
+    std::string headers;
+    std::string body;
+};
+
+/*处理函数：返回false表示内部错误，服务器回复500*/
+typedef std::function<bool(const HandlerRequest &req, HandlerResponse &resp)> Handler;
+
+#endif
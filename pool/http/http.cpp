@@ -6,10 +6,13 @@
   */
 
 #include "http.h"
+#include "httpscan.h"
 
 /*定义HTTP响应的一些状态信息*/
 const char *ok_200_title = "OK";
 
+const char *created_201_title = "Created";
+
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 
@@ -19,63 +22,205 @@ const char *error_403_form = "You do not have permission to get file from this s
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 
+const char *error_405_title = "Method Not Allowed";
+const char *error_405_form = "The requested method is not supported for this resource.\n";
+
+const char *partial_206_title = "Partial Content";
+
+const char *not_modified_304_title = "Not Modified";
+
+const char *error_416_title = "Range Not Satisfiable";
+
+const char *error_413_title = "Content Too Large";
+const char *error_413_form = "The request body is larger than this site allows.\n";
+
+const char *error_429_title = "Too Many Requests";
+const char *error_429_form = "Too many requests from your address, please try again later.\n";
+
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the requested file.\n";
 
-/*网站的根目录*/
-const char *doc_root = "/var/www/html";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is temporarily overloaded, please try again later.\n";
 
-int setnonblocking(int fd)
-{
-    int old_opt = fcntl(fd, F_GETFL);
-    int new_opt = old_opt | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_opt);
-    return old_opt;
-}
+/*过载时使用的完整503响应，启动时生成一次，拒绝请求时直接复制*/
+static std::string shed_response;
+/*accept时超过按地址的限制，直接发送的完整429响应*/
+static std::string limit_response;
+
+/*multipart/byteranges的分隔符*/
+const char *range_boundary = "3d6b6a416f9b5e2c";
 
-void addfd(int epfd, int fd, bool one_shot)
+/*ptr是事件就绪时交给事件循环的数据：客户连接为HTTPConn对象，监听socket为空*/
+void addfd(int epfd, int fd, bool one_shot, void *ptr)
 {
     epoll_event ev;
-    ev.data.fd = fd;
+    ev.data.ptr = ptr;
     ev.events = EPOLLIN | EPOLLET;
     if (one_shot)
     {
         ev.events |= EPOLLONESHOT;
     }
     epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
-    setnonblocking(fd);
+    Stats::add(Stats::SYS_EPOLL_CTL);
 }
 
 void removefd(int epfd, int fd)
 {
     epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
+    Stats::add(Stats::SYS_EPOLL_CTL);
     close(fd);
 }
 
-void modfd(int epfd, int fd, int event)
+void modfd(int epfd, int fd, int event, void *ptr, bool one_shot = true)
 {
     epoll_event ev;
-    ev.data.fd = fd;
-    ev.events = event | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    ev.data.ptr = ptr;
+    ev.events = event | EPOLLET | EPOLLRDHUP;
+    if (one_shot)
+    {
+        ev.events |= EPOLLONESHOT;
+    }
     epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    Stats::add(Stats::SYS_EPOLL_CTL);
 }
 
 //用户数
-int HTTPConn::m_user_count = 0;
-//epoll句柄
-int HTTPConn::m_epollfd = -1;
+std::atomic<int> HTTPConn::m_user_count(0);
+//连接对象池和读写缓冲池
+ObjectPool<HTTPConn> HTTPConn::m_conn_pool;
+ObjectPool<HTTPConn::WriteBuffer> HTTPConn::m_write_pool;
+//各阶段的超时时间，默认值与ServerConfig一致
+int HTTPConn::m_timeouts[PHASE_NUM] = {10000, 30000, 60000, 30000};
+int HTTPConn::m_min_timeout = 10000;
+//虚拟主机表，由main设置
+const HostTable *HTTPConn::m_hosts = nullptr;
+//新连接的TCP调优参数，由ServerConfig设置
+TcpProfile HTTPConn::m_tcp_profile;
+RateLimiter *HTTPConn::m_limiter = nullptr;
+//平滑升级时由升级线程设置
+std::atomic<bool> HTTPConn::m_draining(false);
+//路由表，由main注册处理函数
+Router<HTTPConn::Route> HTTPConn::m_routes;
+std::unordered_map<const VirtualHost *, std::unique_ptr<Router<HTTPConn::Route>>> HTTPConn::m_site_routes;
+
+/*请求方法的名字，按METHOD排列*/
+static const char *const method_names[HTTPConn::METHOD_NUM] = {
+    "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+/*处理函数可能使用的状态码的原因短语*/
+static const char *status_title(int status)
+{
+    switch (status)
+    {
+    case 200: return ok_200_title;
+    case 201: return created_201_title;
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return not_modified_304_title;
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return error_400_title;
+    case 401: return "Unauthorized";
+    case 403: return error_403_title;
+    case 404: return error_404_title;
+    case 405: return error_405_title;
+    case 409: return "Conflict";
+    case 410: return "Gone";
+    case 413: return error_413_title;
+    case 415: return "Unsupported Media Type";
+    case 422: return "Unprocessable Content";
+    case 429: return error_429_title;
+    case 500: return error_500_title;
+    case 501: return "Not Implemented";
+    case 503: return error_503_title;
+    default: return status < 300 ? ok_200_title : status < 500 ? error_400_title : error_500_title;
+    }
+}
+
+bool HTTPConn::add_route(METHOD method, const char *pattern, Handler handler, const char *host)
+{
+    bool reserved = strncmp(pattern, ROUTE_PREFIX, ROUTE_PREFIX_LEN) == 0;
+    Router<Route> *routes = &m_routes;
+    if (host)
+    {
+        const VirtualHost *site = m_hosts ? m_hosts->get(host) : nullptr;
+        if (!site || reserved)
+        {
+            return false;
+        }
+        std::unique_ptr<Router<Route>> &table = m_site_routes[site];
+        if (!table)
+        {
+            table.reset(new Router<Route>);
+        }
+        routes = table.get();
+    }
+    else if (!reserved)
+    {
+        return false;
+    }
+    Route *route = routes->insert(pattern);
+    if (!route || method < 0 || method >= METHOD_NUM)
+    {
+        return false;
+    }
+    route->handlers[method] = std::move(handler);
+    return true;
+}
+
+HTTPConn *HTTPConn::new_conn()
+{
+    return m_conn_pool.acquire();
+}
+
+void HTTPConn::set_hosts(const HostTable *hosts)
+{
+    m_hosts = hosts;
+    /*网站的消息体超时比所有阶段的超时都短（或者全局不限制超时）时，时间轮也要按它检查*/
+    int timeout = hosts->min_body_timeout();
+    if (timeout > 0 && (m_min_timeout == 0 || timeout < m_min_timeout))
+    {
+        m_min_timeout = timeout;
+    }
+}
+
+void HTTPConn::set_timeouts(int header, int body, int idle, int write)
+{
+    m_timeouts[PHASE_HEADER] = header;
+    m_timeouts[PHASE_BODY] = body;
+    m_timeouts[PHASE_IDLE] = idle;
+    m_timeouts[PHASE_WRITE] = write;
+    m_min_timeout = 0;
+    for (int i = 0; i < PHASE_NUM; i++)
+    {
+        if (m_timeouts[i] > 0 && (m_min_timeout == 0 || m_timeouts[i] < m_min_timeout))
+        {
+            m_min_timeout = m_timeouts[i];
+        }
+    }
+}
 
-//初始化客户连接：获得客户信息，并添加到epfd
-void HTTPConn::init(int sockfd, const sockaddr_in &addr)
+//初始化客户连接：获得客户信息，并添加到所属事件循环的epfd。sockfd由accept4创建，已经是非阻塞的
+void HTTPConn::init(int sockfd, const sockaddr_in &addr, int epollfd, bool one_shot, bool counted)
 {
+    m_epollfd = epollfd;
     m_sockfd = sockfd;
     m_address = addr;
+    m_counted = counted;
+    m_one_shot = one_shot;
+    m_event = EPOLLIN;
+    m_read_full = false;
 
-    //开发环境下调试时方便端口复用，生产环境下应该禁用此选项
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    apply_accepted_options(m_sockfd, m_tcp_profile);
 
-    addfd(m_epollfd, m_sockfd, true);
+    if (m_epollfd != -1)
+    {
+        addfd(m_epollfd, m_sockfd, one_shot, this);
+    }
     m_user_count++;
     //初始化其他成员变量
     init();
@@ -83,6 +228,24 @@ void HTTPConn::init(int sockfd, const sockaddr_in &addr)
 
 //初始化成员变量：HTTP协议中的关键字段
 void HTTPConn::init()
+{
+    reset_request();
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_request_start = 0;
+    m_read_idx = 0;
+    m_write = nullptr;
+    m_response_count = 0;
+    m_response_idx = 0;
+    m_response_sent = 0;
+    //第一个请求的请求头从accept开始计时
+    m_active = m_request_time = TimeWheel::now();
+    m_requests = 0;
+    m_busy.store(false, std::memory_order_relaxed);
+}
+
+//重置解析单个请求的状态：下一个请求紧接着上一个请求的末尾开始
+void HTTPConn::reset_request()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
@@ -90,59 +253,327 @@ void HTTPConn::init()
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_has_content_length = false;
+    m_body_size = 0;
+    m_chunked = false;
+    m_body.init_length(0);
+    release_body();
+    m_route = nullptr;
+    m_handler = nullptr;
+    m_params.count = 0;
+    /*为一个大消息体增长过的缓冲区不留给连接上的下一个请求*/
+    if (m_body_data.capacity() > READ_BUFFER_SIZE)
+    {
+        std::string().swap(m_body_data);
+    }
+    m_body_data.clear();
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+    m_vhost = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_request_start = m_checked_idx;
+    m_start_line = m_checked_idx;
+    m_file.reset();
+}
+
+/*把尚未处理的数据（下一个请求已经到达的部分）移到缓冲区开头，而不是清空缓冲区。
+解析到一半的请求中的指针也随之移动*/
+void HTTPConn::compact_read_buf()
+{
+    int shift = m_request_start;
+    if (shift != 0)
+    {
+        char *buf = m_read_buf.data();
+        memmove(buf, buf + shift, m_read_idx - shift);
+        m_read_idx -= shift;
+        m_checked_idx -= shift;
+        m_start_line -= shift;
+        m_request_start = 0;
+        rebase_read_ptrs(buf, shift);
+    }
+    /*为一个大请求增长过的读缓冲区，在剩余数据放得下时换回初始大小的内存块，
+    大内存块回到缓冲池给其他连接使用*/
+    const char *old_base = m_read_buf.data();
+    m_read_buf.shrink(m_read_idx, BufferPool::size_class(READ_BUFFER_SIZE));
+    rebase_read_ptrs(old_base, 0);
+}
+
+void HTTPConn::rebase_read_ptrs(const char *old_base, int shift)
+{
+    char *base = m_read_buf.data();
+    char **ptrs[] = {&m_url, &m_version, &m_host, &m_range, &m_if_range, &m_if_none_match, &m_if_modified_since, &m_accept_encoding};
+    for (size_t i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++)
+    {
+        if (*ptrs[i])
+        {
+            *ptrs[i] = base + (*ptrs[i] - old_base) - shift;
+        }
+    }
+}
+
+bool HTTPConn::acquire_read_buf()
+{
+    return m_read_buf.reserve(READ_BUFFER_SIZE, 0);
 }
 
-//关闭连接：删除节点，用户数-1
+void HTTPConn::release_read_buf()
+{
+    m_read_buf.release();
+}
+
+bool HTTPConn::acquire_write_buf()
+{
+    if (!m_write)
+    {
+        m_write = m_write_pool.acquire();
+    }
+    return m_write != nullptr;
+}
+
+void HTTPConn::release_write_buf()
+{
+    if (m_write)
+    {
+        m_write_pool.release(m_write);
+        m_write = nullptr;
+    }
+}
+
+//关闭连接：删除节点，用户数-1，归还缓冲区和连接对象
 void HTTPConn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
-        removefd(m_epollfd, m_sockfd);
+        release_file();
+        release_body();
+        clear_responses();
+        release_read_buf();
+        if (m_epollfd != -1)
+        {
+            removefd(m_epollfd, m_sockfd);
+        }
+        else
+        {
+            close(m_sockfd);
+        }
         m_sockfd = -1;
         m_user_count--;
+        if (m_counted)
+        {
+            m_limiter->close_conn(m_address);
+        }
+        //放回对象池之后，该对象可能立即被其他事件循环取走，之后不能再访问任何成员
+        m_conn_pool.release(this);
     }
 }
 
-//处理http数据
+/*处理http数据：在工作线程中解析请求，根据是否生成了响应，重新注册读或写事件。
+连接只由事件循环关闭（同时从时间轮上删除），处理失败时这里只shutdown，重新注册之后事件循环会收到EPOLLHUP*/
 void HTTPConn::process()
 {
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST)
+    int event = EPOLLIN;
+    if (!handle_requests())
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+        shutdown_conn();
+    }
+    else if (m_response_count > 0)
+    {
+        event = EPOLLOUT;
+    }
+    rearm(event);
+}
+
+bool HTTPConn::process_inline()
+{
+    if (!handle_requests())
+    {
+        return false;
+    }
+    //生成了响应就立即发送，大多数响应一次就能发完，不需要注册EPOLLOUT
+    if (m_response_count > 0)
+    {
+        return Write();
+    }
+    wait_for(EPOLLIN);
+    return true;
+}
+
+void HTTPConn::wait_for(int event)
+{
+    if (m_one_shot || event != m_event || m_read_full)
+    {
+        modfd(m_epollfd, m_sockfd, event, this, m_one_shot);
+        m_event = event;
+        m_read_full = false;
+    }
+}
+
+void HTTPConn::set_rate_limiter(RateLimiter *limiter)
+{
+    m_limiter = limiter;
+    char buf[512];
+    snprintf(buf, sizeof(buf), "HTTP/1.1 429 %s\r\nRetry-After:1\r\nContent-Length:%d\r\nConnection:close\r\n\r\n%s",
+             error_429_title, (int)strlen(error_429_form), error_429_form);
+    limit_response = buf;
+}
+
+/*拒绝时新连接的socket发送缓冲区是空的，一次非阻塞send就能发出整个响应，发不出时直接关闭*/
+bool HTTPConn::admit(int cfd, const sockaddr_in &addr, long now, bool &counted)
+{
+    counted = false;
+    if (!m_limiter)
+    {
+        return true;
+    }
+    RateLimiter::ADMIT ret = m_limiter->open_conn(addr, now);
+    if (ret == RateLimiter::REJECTED || ret == RateLimiter::SATURATED)
+    {
+        Stats::add(Stats::CONN_LIMITED);
+        if (ret == RateLimiter::SATURATED)
+        {
+            Stats::add(Stats::CONN_SATURATED);
+        }
+        send(cfd, limit_response.data(), limit_response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        close(cfd);
+        return false;
+    }
+    counted = ret == RateLimiter::COUNTED;
+    return true;
+}
+
+void HTTPConn::release_admit(const sockaddr_in &addr, bool counted)
+{
+    if (counted)
+    {
+        m_limiter->close_conn(addr);
+    }
+}
+
+void HTTPConn::set_retry_after(int seconds)
+{
+    char buf[512];
+    snprintf(buf, sizeof(buf), "HTTP/1.1 503 %s\r\nRetry-After:%d\r\nContent-Length:%d\r\nConnection:close\r\n\r\n%s",
+             error_503_title, seconds, (int)strlen(error_503_form), error_503_form);
+    shed_response = buf;
+}
+
+/*读缓冲区中的请求不再解析，已经收到的数据随连接一起丢弃。事件循环（请求队列已满）和工作线程（排队太久）都会调用*/
+void HTTPConn::shed()
+{
+    int event = EPOLLOUT;
+    m_linger = false;
+    Stats::status(503);
+    if (acquire_write_buf())
+    {
+        int start = m_write->out.size();
+        if (add_block(shed_response.data(), shed_response.size()))
+        {
+            push_response(start, 0, 0);
+        }
+    }
+    if (m_response_count == 0)
+    {
+        shutdown_conn();
+        event = EPOLLIN;
+    }
+    rearm(event);
+}
+
+void HTTPConn::rearm(int event)
+{
+    //清除m_busy之后事件循环可能立即检查超时，重新注册之后可能立即关闭连接，这里先取出要用的成员
+    int epollfd = m_epollfd;
+    int sockfd = m_sockfd;
+    m_busy.store(false, std::memory_order_release);
+    modfd(epollfd, sockfd, event, this);
+}
+
+/*流水线的客户端可以连续发送多个请求，这里依次解析读缓冲区中的所有完整请求，
+它们的响应排队之后一起发送*/
+bool HTTPConn::handle_requests()
+{
+    if (!acquire_write_buf())
+    {
+        return false;
+    }
+    while (m_response_count < MAX_PIPELINE && m_write->out.space() >= MIN_RESPONSE_SPACE)
+    {
+        long start = Stats::now();
+        HTTP_CODE read_ret = process_read();
+        if (read_ret == NO_REQUEST)
+        {
+            break;
+        }
+        //只统计解析出完整请求的那一次，读缓冲区中没有完整请求的检查不计入
+        Stats::record(Stats::STAGE_PARSE, Stats::now() - start);
+        //出错的请求、以及消息体没有读完就出错的请求，无法确定下一个请求从哪里开始，发送错误响应后关闭连接
+        if (read_ret == BAD_REQUEST || !m_body.done())
+        {
+            m_linger = false;
+        }
+        if (!process_write(read_ret))
+        {
+            return false;
+        }
+        bool linger = m_linger;
+        m_requests++;
+        Stats::add(Stats::REQUESTS);
+        reset_request();
+        //客户端要求关闭连接，之后的请求不再处理
+        if (!linger)
+        {
+            break;
+        }
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    if (m_response_count == 0)
     {
-        close_conn();
+        //没有生成响应，不占用写缓冲区；也没有收到任何数据时读缓冲区一并归还
+        release_write_buf();
+        if (m_read_idx == 0)
+        {
+            release_read_buf();
+        }
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    return true;
 }
 
-//非阻塞读：循环读取客户数据，直到无数据可读或者对方关闭连接
+/*非阻塞读：循环读取客户数据，直到无数据可读或者对方关闭连接。
+readv先填满读缓冲区的剩余空间，多出来的部分读到栈上的extra中，只有数据确实超出当前内存块时
+才把读缓冲区换成更大的一级，再把extra中的数据复制过去；普通的小请求不需要任何额外的复制*/
 bool HTTPConn::Read()
 {
-    //判断是否超出读缓冲区
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    StageTimer timer(Stats::STAGE_READ);
+    //有数据到达时才借用读缓冲区
+    if (!acquire_read_buf())
+    {
+        return false;
+    }
+    //读缓冲区已经增长到上限，仍然没有一个完整的请求
+    if (m_read_idx >= MAX_READ_BUFFER_SIZE)
     {
-        false;
+        return false;
     }
 
-    int bytes_read = 0;
-    //循环读取客户数据
-    while (1)
+    char extra[EXTRA_READ_SIZE];
+    //循环读取客户数据，读缓冲区达到上限后暂停，处理完已有的请求后再继续读
+    while (m_read_idx < MAX_READ_BUFFER_SIZE)
     {
-        //接收读取到的字符，读缓冲区逐渐缩小
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        int tail = m_read_buf.capacity() - m_read_idx;
+        int extra_len = MAX_READ_BUFFER_SIZE - m_read_buf.capacity();
+        if (extra_len > EXTRA_READ_SIZE)
+        {
+            extra_len = EXTRA_READ_SIZE;
+        }
+        struct iovec iv[2];
+        iv[0].iov_base = m_read_buf.data() + m_read_idx;
+        iv[0].iov_len = tail;
+        iv[1].iov_base = extra;
+        iv[1].iov_len = extra_len;
+        int bytes_read = readv(m_sockfd, iv, extra_len > 0 ? 2 : 1);
+        Stats::add(Stats::SYS_READ);
         if (bytes_read == -1)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -155,9 +586,45 @@ bool HTTPConn::Read()
         {
             return false;
         }
-        m_read_idx += bytes_read;
-        return true;
+        Stats::add(Stats::BYTES_IN, bytes_read);
+        if (bytes_read <= tail)
+        {
+            m_read_idx += bytes_read;
+            /*没有读满，说明socket接收缓冲区已经读空，不必再读一次确认EAGAIN。
+            之后到达的数据会产生新的边沿事件（工作线程重新注册事件时也会重新检查）*/
+            if (bytes_read < tail)
+            {
+                break;
+            }
+            continue;
+        }
+        //数据超出了当前内存块，增长读缓冲区后把extra中的部分追加进去
+        m_read_idx += tail;
+        if (!feed(extra, bytes_read - tail))
+        {
+            return false;
+        }
+    }
+    m_read_full = m_read_idx >= MAX_READ_BUFFER_SIZE;
+    return true;
+}
+
+bool HTTPConn::feed(const char *data, int len)
+{
+    if (!acquire_read_buf() || m_read_idx + len > MAX_READ_BUFFER_SIZE)
+    {
+        return false;
+    }
+    //增长读缓冲区时换了内存块，指向旧内存块的指针随之修正
+    const char *old_base = m_read_buf.data();
+    if (!m_read_buf.reserve(m_read_idx + len, m_read_idx))
+    {
+        return false;
     }
+    rebase_read_ptrs(old_base, 0);
+    memcpy(m_read_buf.data() + m_read_idx, data, len);
+    m_read_idx += len;
+    return true;
 }
 //主状态机，解析HTTP请求
 HTTPConn::HTTP_CODE HTTPConn::process_read()
@@ -169,7 +636,13 @@ HTTPConn::HTTP_CODE HTTPConn::process_read()
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        printf("got 1 http line: %s\n", text);
+        /*消息体不是以'\0'结尾的文本，不记录。跟踪记录可以被导出，不能包含其他用户的凭据：
+        请求行只记录到查询字符串之前，头部字段只记录字段名（Cookie、Authorization的值不记录）*/
+        if (m_check_state != CHECK_STATE_CONTENT)
+        {
+            TRACE_TEXT(TRACE_DEBUG, Trace::HTTP_LINE, m_sockfd, m_requests, text,
+                       (int)strcspn(text, m_check_state == CHECK_STATE_REQUESTLINE ? "?" : ":"));
+        }
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
@@ -184,22 +657,26 @@ HTTPConn::HTTP_CODE HTTPConn::process_read()
         case CHECK_STATE_HEADER:
         {
             ret = parse_headers(text);
-            if (ret == BAD_REQUEST)
+            if (ret == GET_REQUEST)
             {
-                return BAD_REQUEST;
+                return end_request();
             }
-            else if (ret == GET_REQUEST)
+            else if (ret != NO_REQUEST)
             {
-                return do_request();
+                return ret;
             }
             break;
         }
         case CHECK_STATE_CONTENT:
         {
-            ret = parse_content(text);
+            ret = parse_content();
             if (ret == GET_REQUEST)
             {
-                return do_request();
+                return end_request();
+            }
+            else if (ret != NO_REQUEST)
+            {
+                return ret;
             }
             line_status = LINE_OPEN;
             break;
@@ -210,35 +687,125 @@ HTTPConn::HTTP_CODE HTTPConn::process_read()
         }
         }
     }
+    if (line_status == LINE_BAD)
+    {
+        return BAD_REQUEST;
+    }
+    return NO_REQUEST;
+}
+
+/*解析Range头部字段的值，如"bytes=0-499, 1000-, -200"，可满足的区间按出现的顺序存入starts/lens。
+返回可满足的区间数；语法错误、不是bytes单位或者区间超过max个时返回0，表示忽略Range、发送整个文件；
+语法正确但所有区间都不可满足时返回-1*/
+static int parse_ranges(const char *spec, off_t size, off_t *starts, off_t *lens, int max)
+{
+    if (strncasecmp(spec, "bytes=", 6) != 0)
+    {
+        return 0;
+    }
+    const char *p = spec + 6;
+    int total = 0;
+    int count = 0;
+    while (1)
+    {
+        p += strspn(p, " \t");
+        if (*p == ',')
+        {
+            p++;
+            continue;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        off_t first = -1, last = -1;
+        char *end;
+        if (*p >= '0' && *p <= '9')
+        {
+            first = strtoll(p, &end, 10);
+            p = end;
+        }
+        if (*p != '-')
+        {
+            return 0;
+        }
+        p++;
+        if (*p >= '0' && *p <= '9')
+        {
+            last = strtoll(p, &end, 10);
+            p = end;
+        }
+        p += strspn(p, " \t");
+        if ((*p != ',' && *p != '\0') || (first < 0 && last < 0) || (last >= 0 && first > last))
+        {
+            return 0;
+        }
+        total++;
+        off_t start, len;
+        if (first < 0)
+        {
+            /*"-n"：最后n个字节*/
+            if (last == 0)
+            {
+                continue;
+            }
+            start = last > size ? 0 : size - last;
+            len = size - start;
+        }
+        else
+        {
+            if (first >= size)
+            {
+                continue;
+            }
+            len = (last < 0 || last >= size ? size - 1 : last) - first + 1;
+            start = first;
+        }
+        if (count == max)
+        {
+            return 0;
+        }
+        starts[count] = start;
+        lens[count] = len;
+        count++;
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    return count == 0 ? -1 : count;
 }
 
 //从状态机，解析请求体的每一行：直到读取到回车换行符时，才是完整的一行
 HTTPConn::LINE_STATUS HTTPConn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    /*用向量化的扫描函数一次跳过16/32个普通字符，直接定位到下一个'\r'或'\n'*/
+    char *buf = m_read_buf.data();
+    const char *end = buf + m_read_idx;
+    m_checked_idx = find_line_end(buf + m_checked_idx, end) - buf;
+    if (m_checked_idx < m_read_idx)
     {
-        temp = m_read_buf[m_checked_idx];
+        char temp = buf[m_checked_idx];
         if (temp == '\r')
         {
             if ((m_checked_idx + 1) == m_read_idx)
             {
                 return LINE_OPEN;
             }
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
+            else if (buf[m_checked_idx + 1] == '\n')
             {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                buf[m_checked_idx++] = '\0';
+                buf[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
         }
-        else if (temp == '\n')
+        else
         {
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r'))
+            if ((m_checked_idx > 1) && (buf[m_checked_idx - 1] == '\r'))
             {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
+                buf[m_checked_idx - 1] = '\0';
+                buf[m_checked_idx++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
@@ -257,14 +824,16 @@ HTTPConn::HTTP_CODE HTTPConn::parse_request_line(char *text)
     }
     *m_url++ = '\0';
     char *method = text;
-    if (strcasecmp(method, "GET") == 0)
+    int i = 0;
+    while (i < METHOD_NUM && strcasecmp(method, method_names[i]) != 0)
     {
-        m_method = GET;
+        i++;
     }
-    else
+    if (i == METHOD_NUM)
     {
         return BAD_REQUEST;
     }
+    m_method = (METHOD)i;
     m_url += strspn(m_url, " ");
     m_version = strpbrk(m_url, " ");
     if (!m_version)
@@ -297,168 +866,784 @@ HTTPConn::HTTP_CODE HTTPConn::parse_headers(char *text)
     /*遇到空行，表示头部字段解析完毕*/
     if (text[0] == '\0')
     {
-        /*如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，状态机转移到CHECK_STATE_CONTENT状态*/
-        if (m_content_length != 0)
-        {
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
-        }
-        /*否则说明我们已经得到了一个完整的HTTP请求*/
-        return GET_REQUEST;
+        return begin_body();
     }
+    /*字段名在冒号之前，按字段名的长度分派查找*/
+    char *colon = strchr(text, ':');
+    if (!colon)
+    {
+        return BAD_REQUEST;
+    }
+    HEADER_ID id = lookup_header(text, colon - text);
+    const char *name = text;
+    text = colon + 1;
+    text += strspn(text, " \t");
+    switch (id)
+    {
     /*处理Connection头部字段*/
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    case HEADER_CONNECTION:
     {
-        text += 11;
-        text += strspn(text, " ");
         if (strcasecmp(text, "keep-alive") == 0)
         {
             m_linger = true;
         }
+        break;
     }
     /*处理Content-Length头部字段*/
-    else if (strncasecmp(text, "Content-Length:", 15) == 0)
+    case HEADER_CONTENT_LENGTH:
+    {
+        /*消息体的边界由它决定，不是纯数字的值一律拒绝；重复出现且值不同时无法确定边界，也拒绝*/
+        char *end;
+        long length = strtol(text, &end, 10);
+        if (text[0] < '0' || text[0] > '9' || *end != '\0' || (m_has_content_length && length != m_content_length))
+        {
+            return BAD_REQUEST;
+        }
+        m_content_length = length;
+        m_has_content_length = true;
+        break;
+    }
+    /*处理Transfer-Encoding头部字段，只支持chunked*/
+    case HEADER_TRANSFER_ENCODING:
     {
-        text += 15;
-        text += strspn(text, " ");
-        m_content_length = atol(text);
+        if (strcasecmp(text, "chunked") != 0)
+        {
+            return BAD_REQUEST;
+        }
+        m_chunked = true;
+        break;
     }
     /*处理Host头部字段*/
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    case HEADER_HOST:
     {
-        text += 5;
-        text += strspn(text, " ");
         m_host = text;
+        break;
     }
-    else
+    /*处理Range头部字段，生成响应时才根据文件大小解析*/
+    case HEADER_RANGE:
     {
-        printf("oop!unknow headers\n");
+        m_range = text;
+        break;
+    }
+    /*处理条件请求的头部字段，得到目标文件的校验器之后才判断*/
+    case HEADER_IF_RANGE:
+    {
+        m_if_range = text;
+        break;
+    }
+    case HEADER_IF_NONE_MATCH:
+    {
+        m_if_none_match = text;
+        break;
+    }
+    /*处理Accept-Encoding头部字段，找到目标文件之后才根据有哪些预压缩副本选择*/
+    case HEADER_ACCEPT_ENCODING:
+    {
+        m_accept_encoding = text;
+        break;
+    }
+    case HEADER_IF_MODIFIED_SINCE:
+    {
+        m_if_modified_since = text;
+        break;
+    }
+    default:
+    {
+        TRACE_TEXT(TRACE_DEBUG, Trace::UNKNOWN_HEADER, m_sockfd, 0, name, (int)(colon - name));
+        break;
+    }
     }
     return NO_REQUEST;
 }
 
-// 解析请求数据，POST请求才会有请求数据，GET请求没有
-/*没有真正解析HTTP请求的消息体，只是判断它是否被完整地读入了*/
-HTTPConn::HTTP_CODE HTTPConn::parse_content(char *text)
+/*如果HTTP请求有消息体，状态机转移到CHECK_STATE_CONTENT状态，否则说明我们已经得到了一个完整的HTTP请求*/
+HTTPConn::HTTP_CODE HTTPConn::begin_body()
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    /*请求头已经全部收到，按Host选择网站，之后的处理都使用这个网站的设置*/
+    m_vhost = m_hosts->find(m_host);
+    /*旧进程正在退出：这个请求的响应之后关闭连接，客户端在新的连接上（由新进程接受）发送之后的请求*/
+    if (m_draining.load(std::memory_order_relaxed))
+    {
+        m_linger = false;
+    }
+    /*同时带有两种长度的请求可能被前后两个服务器按不同的方式划分（请求走私），直接拒绝*/
+    if (m_chunked && m_has_content_length)
+    {
+        return BAD_REQUEST;
+    }
+    if (m_chunked)
+    {
+        m_body.init_chunked();
+    }
+    else
+    {
+        m_body.init_length(m_content_length);
+    }
+    /*按客户端地址限制请求速率：令牌用完时回复429，之后关闭连接（带有消息体时不接收）*/
+    if (m_limiter && (m_limit_wait = m_limiter->take(m_address, TimeWheel::now())) > 0)
+    {
+        m_linger = false;
+        return TOO_MANY_REQUESTS;
+    }
+    /*网站限制的消息体大小：声明的长度超过时不接收，chunked编码的在解码时检查*/
+    if (m_vhost->max_body >= 0 && m_content_length > m_vhost->max_body)
+    {
+        return TOO_LARGE;
+    }
+    /*路径（不含查询字符串）匹配了路由的请求交给处理函数：ROUTE_PREFIX之下查找服务器路由，其他路径查找所选网站自己的路由。
+    路由中没有这个方法时回复405（带有消息体时随后关闭连接）；其他请求由静态文件处理，只支持GET和PUT*/
+    int path_len = strcspn(m_url, "?");
+    if (strncmp(m_url, ROUTE_PREFIX, ROUTE_PREFIX_LEN) == 0)
+    {
+        m_route = m_routes.match(m_url, path_len, m_params);
+    }
+    else if (!m_site_routes.empty())
+    {
+        auto it = m_site_routes.find(m_vhost);
+        m_route = it == m_site_routes.end() ? nullptr : it->second->match(m_url, path_len, m_params);
+    }
+    if (m_route)
+    {
+        m_handler = &m_route->handlers[m_method];
+        if (!*m_handler)
+        {
+            return NOT_ALLOWED;
+        }
+    }
+    else if (m_method != GET && m_method != PUT)
+    {
+        return BAD_REQUEST;
+    }
+    if (m_handler)
+    {
+        /*路由请求的消息体收集在内存中，声明的长度超过上限时回复413，不接收*/
+        if (m_content_length > MAX_HANDLER_BODY)
+        {
+            return TOO_LARGE;
+        }
+    }
+    else if (m_method == PUT)
+    {
+        /*网站不允许上传*/
+        if (m_vhost->upload_dirfd == -1)
+        {
+            return BAD_REQUEST;
+        }
+        /*目标只能是上传目录中的一个文件名：不能包含子目录，不能以'.'开头（排除..和上传中的临时文件）*/
+        const char *name = m_url + 1;
+        int len = strlen(name);
+        if (len == 0 || len > FILENAME_LEN / 2 || name[0] == '.' || strpbrk(name, "/?"))
+        {
+            return FORBIDDEN_REQUEST;
+        }
+        /*消息体写入上传目录中的匿名临时文件，接收完之后才链接到目标文件名，
+        中途失败或者连接断开时关闭文件即可，不会留下写了一半的文件*/
+        m_body_fd = openat(m_vhost->upload_dirfd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+        if (m_body_fd == -1)
+        {
+            return INTERNAL_ERROR;
+        }
+    }
+    if (m_body.done())
     {
-        text[m_content_length] = '\0';
         return GET_REQUEST;
     }
+    m_check_state = CHECK_STATE_CONTENT;
     return NO_REQUEST;
 }
 
-/*当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性。
-如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其映射到内存地址m_file_address处，并告诉调用者获取文件成功*/
+/*解析请求的消息体：读缓冲区中已经到达的消息体数据交给解码器，解码出的数据写入临时文件、
+收集到m_body_data（路由请求，chunked编码的消息体超过上限时回复413）或者丢弃，
+然后从读缓冲区中删除，后面的数据（流水线中的下一个请求）前移到请求头之后。
+请求头中的字段仍然指向读缓冲区，不受影响；读缓冲区的大小不随消息体增长*/
+HTTPConn::HTTP_CODE HTTPConn::parse_content()
+{
+    char *buf = m_read_buf.data();
+    bool write_failed = false;
+    int fd = m_body_fd;
+    std::string *collect = m_handler ? &m_body_data : nullptr;
+    long *size = &m_body_size;
+    long max_body = m_vhost->max_body;
+    bool too_large = false;
+    int n = m_body.decode(buf + m_checked_idx, m_read_idx - m_checked_idx, [fd, collect, size, max_body, &write_failed, &too_large](const char *data, int len) {
+        *size += len;
+        if (max_body >= 0 && *size > max_body)
+        {
+            too_large = true;
+            return false;
+        }
+        if (collect)
+        {
+            if (collect->size() + len > (size_t)MAX_HANDLER_BODY)
+            {
+                too_large = true;
+                return false;
+            }
+            collect->append(data, len);
+            return true;
+        }
+        while (fd != -1 && len > 0)
+        {
+            int ret = write(fd, data, len);
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                write_failed = true;
+                return false;
+            }
+            data += ret;
+            len -= ret;
+        }
+        return true;
+    });
+    if (n < 0)
+    {
+        if (too_large)
+        {
+            return TOO_LARGE;
+        }
+        return write_failed ? INTERNAL_ERROR : BAD_REQUEST;
+    }
+    memmove(buf + m_checked_idx, buf + m_checked_idx + n, m_read_idx - m_checked_idx - n);
+    m_read_idx -= n;
+    return m_body.done() ? GET_REQUEST : NO_REQUEST;
+}
+
+HTTPConn::HTTP_CODE HTTPConn::end_request()
+{
+    if (m_handler)
+    {
+        return do_handler();
+    }
+    return m_method == PUT ? do_upload() : do_request();
+}
+
+/*当得到一个完整、正确的HTTP请求时，我们就从文件缓存中获取目标文件。
+如果目标文件存在、对所有用户可读，且不是目录，缓存项中保存着打开的文件描述符和文件属性：
+小文件另有常驻内存的副本，直接用writev发送；大文件则由sendfile直接从页缓存发送，并告诉调用者获取文件成功*/
 HTTPConn::HTTP_CODE HTTPConn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    if (stat(m_real_file, &m_file_stat) < 0)
+    StageTimer timer(Stats::STAGE_DO_REQUEST);
+    /*URL中的".."路径段会跳出网站的根目录（访问其他网站或者系统中的文件），拒绝*/
+    for (const char *p = strstr(m_url, "/.."); p; p = strstr(p + 1, "/.."))
     {
-        return NO_RESOURCE;
+        if (p[3] == '/' || p[3] == '\0' || p[3] == '?')
+        {
+            return FORBIDDEN_REQUEST;
+        }
     }
-    if (!(m_file_stat.st_mode & S_IROTH))
+    /*客户请求的目标文件的完整路径，其内容等于网站的根目录+m_url。
+    文件缓存以完整路径为键，所有网站共享，每个网站可以有自己的常驻内存和有效期设置*/
+    char real_file[FILENAME_LEN];
+    int len = m_vhost->root.size();
+    memcpy(real_file, m_vhost->root.data(), len);
+    strncpy(real_file + len, m_url, FILENAME_LEN - len - 1);
+    real_file[FILENAME_LEN - 1] = '\0';
+    int err = 0;
+    m_file = FileCache::getInstance().acquire(real_file, err, m_vhost->cache_small, m_vhost->cache_ttl);
+    if (!m_file)
     {
-        return FORBIDDEN_REQUEST;
+        if (err == EACCES)
+        {
+            return FORBIDDEN_REQUEST;
+        }
+        if (err == EISDIR)
+        {
+            return BAD_REQUEST;
+        }
+        return NO_RESOURCE;
     }
-    if (S_ISDIR(m_file_stat.st_mode))
+    /*之后的条件请求、Range和发送都针对选中的表示*/
+    select_encoding();
+    /*客户端缓存的副本仍然有效：只回复304，不发送文件*/
+    if (not_modified())
     {
-        return BAD_REQUEST;
+        return NOT_MODIFIED;
     }
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
     return FILE_REQUEST;
 }
 
-/*对内存映射区执行munmap操作*/
-void HTTPConn::unmap()
+HTTPConn::HTTP_CODE HTTPConn::do_upload()
 {
-    if (m_file_address)
+    StageTimer timer(Stats::STAGE_DO_REQUEST);
+    /*linkat不能覆盖已有的文件：先链接成一个唯一的临时名字，再rename到目标文件名，
+    正在读这个文件的请求看到的要么是旧文件，要么是完整的新文件*/
+    char proc_path[64];
+    char tmp_name[FILENAME_LEN];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", m_body_fd);
+    snprintf(tmp_name, sizeof(tmp_name), ".%s.%d.upload", m_url + 1, m_body_fd);
+    int dirfd = m_vhost->upload_dirfd;
+    if (linkat(AT_FDCWD, proc_path, dirfd, tmp_name, AT_SYMLINK_FOLLOW) == -1)
+    {
+        return INTERNAL_ERROR;
+    }
+    if (renameat(dirfd, tmp_name, dirfd, m_url + 1) == -1)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        unlinkat(dirfd, tmp_name, 0);
+        return INTERNAL_ERROR;
     }
+    release_body();
+    return UPLOAD_REQUEST;
 }
 
-//非阻塞写
-bool HTTPConn::Write()
+void HTTPConn::release_body()
 {
-    int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
-    if (bytes_to_send == 0)
+    if (m_body_fd != -1)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+    }
+}
+
+/*处理函数的响应可能比写缓冲区大，整个响应（响应头和消息体）拼在一个不进入文件缓存的缓存项中，
+和长连接上常驻内存的小文件一样作为一整块用writev发送*/
+HTTPConn::HTTP_CODE HTTPConn::do_handler()
+{
+    StageTimer timer(Stats::STAGE_DO_REQUEST);
+    HandlerRequest req;
+    req.method = m_method;
+    req.path = m_url;
+    req.path_len = strcspn(m_url, "?");
+    req.query = m_url[req.path_len] == '?' ? m_url + req.path_len + 1 : "";
+    req.host = m_host;
+    req.peer = &m_address;
+    req.params = &m_params;
+    req.body = &m_body_data;
+    HandlerResponse resp;
+    /*处理函数抛出的异常不能离开工作线程或者事件循环，按处理函数失败回复500*/
+    bool ok;
+    try
+    {
+        ok = (*m_handler)(req, resp);
+    }
+    catch (...)
+    {
+        ok = false;
+    }
+    if (!ok || resp.status < 100 || resp.status > 999)
+    {
+        return INTERNAL_ERROR;
+    }
+    char head[256];
+    int head_len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type:%s\r\n", resp.status,
+                            status_title(resp.status), resp.content_type.c_str());
+    if (head_len >= (int)sizeof(head))
+    {
+        return INTERNAL_ERROR;
+    }
+    char tail[64];
+    int tail_len = snprintf(tail, sizeof(tail), "Content-Length:%zu\r\nConnection:%s\r\n\r\n", resp.body.size(),
+                            m_linger ? "keep-alive" : "close");
+    int header_len = head_len + resp.headers.size() + tail_len;
+    FileEntryPtr entry = std::make_shared<FileEntry>();
+    entry->response_len = header_len + resp.body.size();
+    entry->response = new char[entry->response_len];
+    char *p = entry->response;
+    memcpy(p, head, head_len);
+    p += head_len;
+    memcpy(p, resp.headers.data(), resp.headers.size());
+    p += resp.headers.size();
+    memcpy(p, tail, tail_len);
+    p += tail_len;
+    memcpy(p, resp.body.data(), resp.body.size());
+    entry->data = p;
+    entry->st.st_size = resp.body.size();
+    m_file = entry;
+    m_handler_status = resp.status;
+    return HANDLER_REQUEST;
+}
+
+/*If-None-Match的值是逗号分隔的实体标签列表或者"*"，按弱比较：忽略W/前缀，比较引号中的内容*/
+static bool etag_list_match(const char *list, const std::string &etag)
+{
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (*p == '*')
+        {
+            return true;
+        }
+        if (strncmp(p, "W/", 2) == 0)
+        {
+            p += 2;
+        }
+        size_t len = strcspn(p, " \t,");
+        if (len == etag.size() && strncmp(p, etag.data(), len) == 0)
+        {
+            return true;
+        }
+        p += len;
+    }
+    return false;
+}
+
+/*解析HTTP-date（IMF-fixdate格式），失败时返回-1*/
+static time_t parse_http_date(const char *text)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end)
+    {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+bool HTTPConn::not_modified() const
+{
+    /*有If-None-Match时忽略If-Modified-Since*/
+    if (m_if_none_match)
+    {
+        return etag_list_match(m_if_none_match, m_file->etag);
+    }
+    if (m_if_modified_since)
+    {
+        time_t since = parse_http_date(m_if_modified_since);
+        return since != -1 && m_file->mtime <= since;
+    }
+    return false;
+}
+
+/*Accept-Encoding是逗号分隔的内容编码列表，每项可以带q值（0到1，最多3位小数），q=0表示不接受。
+返回coding的q值乘以1000：按名字出现时以它的q值为准，否则看有没有"*"，都没有时返回absent*/
+static int encoding_qvalue(const char *list, const char *coding, int absent)
+{
+    int len = strlen(coding);
+    int star = -1;
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        const char *name = p;
+        int n = strcspn(p, " \t,;");
+        p += n;
+        //参数中只关心q值
+        int q = 1000;
+        p += strspn(p, " \t");
+        while (*p == ';')
+        {
+            p++;
+            p += strspn(p, " \t");
+            if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=')
+            {
+                double v = strtod(p + 2, NULL);
+                q = v > 0 ? (v < 1 ? (int)(v * 1000 + 0.5) : 1000) : 0;
+            }
+            p += strcspn(p, ",;");
+        }
+        if (n == len && strncasecmp(name, coding, len) == 0)
+        {
+            return q;
+        }
+        if (n == 1 && name[0] == '*')
+        {
+            star = q;
+        }
+        p += strcspn(p, ",");
+    }
+    return star >= 0 ? star : absent;
+}
+
+void HTTPConn::select_encoding()
+{
+    if (!m_accept_encoding)
+    {
+        return;
+    }
+    /*选择q值最高的预压缩副本，q值相同时按encoding_names的顺序（br优先于gzip）。
+    明确列出（或者由"*"给出）的identity的q值更高时不压缩；没有列出时不参与比较，只在没有可用的副本时使用*/
+    int best = -1;
+    int best_q = encoding_qvalue(m_accept_encoding, "identity", 0);
+    for (int i = 0; i < ENCODING_NUM; i++)
+    {
+        if (!m_file->encoded[i])
+        {
+            continue;
+        }
+        int q = encoding_qvalue(m_accept_encoding, encoding_names[i], 0);
+        if (q > 0 && (best < 0 ? q >= best_q : q > best_q))
+        {
+            best = i;
+            best_q = q;
+        }
+    }
+    if (best >= 0)
+    {
+        m_file = m_file->encoded[best];
+    }
+}
+
+bool HTTPConn::if_range_match() const
+{
+    if (!m_if_range)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
         return true;
     }
-    while (1)
+    /*实体标签按强比较，弱标签永远不匹配；日期必须与Last-Modified完全相同*/
+    if (m_if_range[0] == '"')
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        if (temp <= -1)
+        return m_file->etag == m_if_range;
+    }
+    return m_file->last_modified == m_if_range;
+}
+
+/*释放目标文件：归还对缓存项的引用，缓存项被淘汰后由最后一个引用者关闭文件*/
+void HTTPConn::release_file()
+{
+    m_file.reset();
+}
+
+int HTTPConn::prepare_iov(bool &more)
+{
+    int count = 0;
+    more = false;
+    off_t skip = m_response_sent;
+    for (int i = m_response_idx; i < m_response_count; i++)
+    {
+        const Response &r = m_write->responses[i];
+        if (skip < r.header_len)
         {
-            /*如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件。
-            虽然在此期间，服务器无法立即接收到同一客户的下一个请求，但这可以保证连接的完整性*/
-            if (errno == EAGAIN)
+            //响应头可能跨越写缓冲区的多个内存块
+            count += m_write->out.fill_iov(m_write->iv + count, MAX_IOV - count, r.header_start + skip, r.header_len - skip);
+            skip = 0;
+            //iovec用完时响应头可能只填入了一部分，消息体留到下一次发送
+            if (count == MAX_IOV)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
-                return true;
+                break;
             }
-            unmap();
-            return false;
         }
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if (bytes_to_send <= bytes_have_send)
+        else
         {
-            /*发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接*/
-            unmap();
-            if (m_linger)
+            skip -= r.header_len;
+        }
+        if (r.body_len == 0)
+        {
+            continue;
+        }
+        //消息体需要sendfile发送，前面的数据先发出去
+        if (use_sendfile(r))
+        {
+            more = true;
+            break;
+        }
+        if (count == MAX_IOV)
+        {
+            break;
+        }
+        m_write->iv[count].iov_base = r.file->data + r.offset + skip;
+        m_write->iv[count].iov_len = r.body_len - skip;
+        count++;
+        skip = 0;
+    }
+    return count;
+}
+
+void HTTPConn::consume(int n)
+{
+    Stats::add(Stats::BYTES_OUT, n);
+    while (m_response_idx < m_response_count)
+    {
+        Response &r = m_write->responses[m_response_idx];
+        off_t left = r.header_len + r.body_len - m_response_sent;
+        if (n < left)
+        {
+            m_response_sent += n;
+            return;
+        }
+        n -= left;
+        r.file.reset();
+        m_response_idx++;
+        m_response_sent = 0;
+    }
+}
+
+bool HTTPConn::sendfile_range(int &fd, off_t &offset, off_t &len) const
+{
+    const Response &cur = m_write->responses[m_response_idx];
+    if (m_response_sent < cur.header_len || !use_sendfile(cur))
+    {
+        return false;
+    }
+    fd = cur.file->fd;
+    offset = cur.offset + (m_response_sent - cur.header_len);
+    len = cur.header_len + cur.body_len - m_response_sent;
+    return true;
+}
+
+void HTTPConn::clear_responses()
+{
+    if (!m_write)
+    {
+        return;
+    }
+    for (int i = 0; i < m_response_count; i++)
+    {
+        m_write->responses[i].file.reset();
+    }
+    m_response_count = 0;
+    m_response_idx = 0;
+    m_response_sent = 0;
+    m_write->out.clear();
+    release_write_buf();
+}
+
+/*非阻塞写：响应队列中连续的内存数据（响应头、错误页面、小文件的常驻副本）合并成一次writev发送；
+遇到需要sendfile发送的大文件时，其前面的数据带MSG_MORE发送，然后用sendfile发送文件。
+一批响应发送完之后，读缓冲区中流水线的后续请求在finish_batch中生成下一批响应，接着发送，不必等下一轮EPOLLOUT*/
+bool HTTPConn::Write()
+{
+    StageTimer timer(Stats::STAGE_WRITE);
+    int temp = 0;
+    while (m_response_count > 0)
+    {
+        while (m_response_idx < m_response_count)
+        {
+            int fd;
+            off_t offset, len;
+            if (sendfile_range(fd, offset, len))
             {
-                init();
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
-                return true;
+                /*sendfile使用显式偏移，不改变共享的文件描述符的文件位置*/
+                temp = sendfile(m_sockfd, fd, &offset, len);
             }
             else
             {
-                modfd(m_epollfd, m_sockfd, EPOLLIN);
+                /*MSG_MORE告诉内核后面还有数据，响应头会和文件的第一段数据合并成满的TCP报文段*/
+                bool more = false;
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = m_write->iv;
+                msg.msg_iovlen = prepare_iov(more);
+                temp = sendmsg(m_sockfd, &msg, more ? MSG_MORE : 0);
+            }
+            Stats::add(Stats::SYS_WRITE);
+            if (temp <= -1)
+            {
+                /*如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件。
+                虽然在此期间，服务器无法立即接收到同一客户的下一个请求，但这可以保证连接的完整性*/
+                if (errno == EAGAIN)
+                {
+                    Stats::add(Stats::WRITE_EAGAIN);
+                    wait_for(EPOLLOUT);
+                    return true;
+                }
                 return false;
             }
+            consume(temp);
         }
+        if (!finish_batch())
+        {
+            return false;
+        }
+    }
+    wait_for(EPOLLIN);
+    return true;
+}
+
+HTTPConn::PHASE HTTPConn::phase() const
+{
+    if (m_response_count > 0)
+    {
+        return PHASE_WRITE;
     }
+    if (m_check_state == CHECK_STATE_CONTENT)
+    {
+        return PHASE_BODY;
+    }
+    //读缓冲区中有不完整的请求，或者新连接还没有发来第一个请求
+    if (m_read_idx > 0 || m_requests == 0)
+    {
+        return PHASE_HEADER;
+    }
+    return PHASE_IDLE;
 }
 
-/*往写缓冲中写入待发送的数据*/
-bool HTTPConn::add_response(const char *format, ...)
+int HTTPConn::touch(long now)
 {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    /*空闲时收到的数据是下一个请求的开头；正在发送响应时已经到达的后续请求，从这批响应发送完开始计时*/
+    PHASE p = phase();
+    if (p == PHASE_IDLE || p == PHASE_WRITE)
     {
+        m_request_time = now;
+    }
+    m_active = now;
+    int remain;
+    expired(now, remain);
+    return remain < m_min_timeout ? remain : m_min_timeout;
+}
+
+bool HTTPConn::expired(long now, int &remain) const
+{
+    PHASE p = phase();
+    int timeout = m_timeouts[p];
+    /*接收消息体时请求头已经选定了网站，按网站自己的超时*/
+    if (p == PHASE_BODY && m_vhost && m_vhost->body_timeout >= 0)
+    {
+        timeout = m_vhost->body_timeout;
+    }
+    /*旧进程正在退出：空闲的长连接只保留很短的时间。不立即关闭，因为客户端可能已经发出了下一个请求，
+    关闭会让这个请求丢失；发来的请求会得到带Connection:close的响应*/
+    if (p == PHASE_IDLE && m_draining.load(std::memory_order_relaxed) && (timeout <= 0 || timeout > DRAIN_IDLE_TIMEOUT))
+    {
+        timeout = DRAIN_IDLE_TIMEOUT;
+    }
+    if (timeout <= 0)
+    {
+        remain = m_min_timeout;
         return false;
     }
-    va_list arg_list;
-    va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+    //请求头从请求开始计时，其他阶段从上次活动计时
+    long start = p == PHASE_HEADER ? m_request_time : m_active;
+    remain = start + timeout - now;
+    return remain <= 0;
+}
+
+bool HTTPConn::finish_batch()
+{
+    /*整批响应发送完毕，根据最后一个请求的Connection字段决定是否立即关闭连接*/
+    bool linger = m_write->responses[m_response_count - 1].linger;
+    clear_responses();
+    if (!linger)
     {
         return false;
     }
-    m_write_idx += len;
-    va_end(arg_list);
+    compact_read_buf();
+    //读缓冲区中还有流水线中后续请求的数据，直接解析，不必等待新的可读事件
+    if (m_read_idx > 0)
+    {
+        return handle_requests();
+    }
+    //连接进入空闲状态，归还读缓冲区
+    release_read_buf();
     return true;
 }
+
+/*往写缓冲中写入待发送的数据*/
+bool HTTPConn::add_response(const char *format, ...)
+{
+    va_list arg_list;
+    va_start(arg_list, format);
+    bool ret = m_write->out.appendv(format, arg_list);
+    va_end(arg_list);
+    return ret;
+}
+/*往写缓冲中追加一段预先生成好的数据，不需要格式化*/
+bool HTTPConn::add_block(const char *data, int len)
+{
+    return m_write->out.append(data, len);
+}
 bool HTTPConn::add_status_line(int status, const char *title)
 {
-    return add_response("%s%d%s\r\n", "HTTP/1.1", status, title);
+    Stats::status(status);
+    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 bool HTTPConn::add_headers(int content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_blank_line();
 }
 bool HTTPConn::add_content_length(int content_len)
 {
@@ -472,14 +1657,21 @@ bool HTTPConn::add_blank_line()
 {
     return add_response("%s", "\r\n");
 }
+bool HTTPConn::add_validators()
+{
+    return add_response("ETag:%s\r\nLast-Modified:%s\r\n%s", m_file->etag.c_str(), m_file->last_modified.c_str(),
+                        m_file->encoding.c_str());
+}
 bool HTTPConn::add_content(const char *content)
 {
     return add_response("%s", content);
 }
 
-/*根据服务器处理HTTP请求的结果，决定返回给客户端的内容*/
+/*根据服务器处理HTTP请求的结果，决定返回给客户端的内容，生成的响应追加到响应队列的末尾*/
 bool HTTPConn::process_write(HTTP_CODE ret)
 {
+    int header_start = m_write->out.size();
+    off_t body_len = 0;
     switch (ret)
     {
     case INTERNAL_ERROR:
@@ -522,21 +1714,103 @@ bool HTTPConn::process_write(HTTP_CODE ret)
         }
         break;
     }
+    case HANDLER_REQUEST:
+    {
+        Stats::status(m_handler_status);
+        off_t header_len = m_file->response_len - m_file->st.st_size;
+        push_response(header_start, -header_len, m_file->response_len);
+        m_file.reset();
+        return true;
+    }
+    case NOT_ALLOWED:
+    {
+        /*Allow列出这个路径注册了处理函数的方法*/
+        char allow[128] = "";
+        for (int i = 0; i < METHOD_NUM; i++)
+        {
+            if (m_route->handlers[i])
+            {
+                strcat(allow, allow[0] ? ", " : "");
+                strcat(allow, method_names[i]);
+            }
+        }
+        if (!add_status_line(405, error_405_title) || !add_response("Allow:%s\r\n", allow) ||
+            !add_headers(strlen(error_405_form)) || !add_content(error_405_form))
+        {
+            return false;
+        }
+        break;
+    }
+    case TOO_LARGE:
+    {
+        if (!add_status_line(413, error_413_title) || !add_headers(strlen(error_413_form)) || !add_content(error_413_form))
+        {
+            return false;
+        }
+        break;
+    }
+    case TOO_MANY_REQUESTS:
+    {
+        if (!add_status_line(429, error_429_title) || !add_response("Retry-After:%d\r\n", m_limit_wait) ||
+            !add_headers(strlen(error_429_form)) || !add_content(error_429_form))
+        {
+            return false;
+        }
+        break;
+    }
+    case UPLOAD_REQUEST:
+    {
+        if (!add_status_line(201, created_201_title) || !add_headers(0))
+        {
+            return false;
+        }
+        break;
+    }
+    /*304响应没有消息体，只带上校验器*/
+    case NOT_MODIFIED:
+    {
+        if (!add_status_line(304, not_modified_304_title) || !add_validators() || !add_linger() || !add_blank_line())
+        {
+            return false;
+        }
+        break;
+    }
     case FILE_REQUEST:
     {
-        add_status_line(200, ok_200_title);
-        if (m_file_stat.st_size != 0)
+        if (m_range && m_file->st.st_size != 0 && if_range_match())
         {
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
+            off_t starts[MAX_RANGES], lens[MAX_RANGES];
+            int count = parse_ranges(m_range, m_file->st.st_size, starts, lens, MAX_RANGES);
+            if (count != 0)
+            {
+                bool ret = process_range(count, starts, lens);
+                m_file.reset();
+                return ret;
+            }
+        }
+        if (m_file->response && m_linger)
+        {
+            /*长连接上的常驻内存小文件：整个响应已经在缓存项中拼好，响应头紧挨在data之前，
+            用负的偏移把响应头和文件内容作为一整块引用，写缓冲区中不生成任何内容*/
+            Stats::status(200);
+            off_t header_len = m_file->response_len - m_file->st.st_size;
+            push_response(header_start, -header_len, m_file->response_len);
+            m_file.reset();
             return true;
         }
+        if (m_file->st.st_size != 0)
+        {
+            /*状态行和Content-Length在缓存项中已经生成好了*/
+            Stats::status(200);
+            if (!add_block(m_file->header.data(), m_file->header.size()) || !add_linger() || !add_blank_line())
+            {
+                return false;
+            }
+            body_len = m_file->st.st_size;
+        }
         else
         {
+            add_status_line(200, ok_200_title);
             const char *ok_string = "＜html＞＜body＞＜/body＞＜/html＞";
             add_headers(strlen(ok_string));
             if (!add_content(ok_string))
@@ -544,14 +1818,92 @@ bool HTTPConn::process_write(HTTP_CODE ret)
                 return false;
             }
         }
+        break;
     }
     default:
     {
         return false;
     }
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
+    push_response(header_start, 0, body_len);
+    m_file.reset();
+    return true;
+}
+
+void HTTPConn::push_response(int header_start, off_t offset, off_t body_len)
+{
+    Response &r = m_write->responses[m_response_count++];
+    r.header_start = header_start;
+    r.header_len = m_write->out.size() - header_start;
+    r.file = body_len > 0 ? m_file : FileEntryPtr();
+    r.offset = offset;
+    r.body_len = body_len;
+    r.linger = m_linger;
+}
+
+/*Range请求的响应：消息体直接引用文件中的区间，常驻内存的文件由writev从副本的相应偏移发送，
+其他文件由sendfile从相应的文件偏移发送，都不需要另外生成消息体。
+一个区间时是普通的206响应；多个区间时是multipart/byteranges，每个区间一个区间头，最后是结尾的分隔符*/
+bool HTTPConn::process_range(int count, const off_t *starts, const off_t *lens)
+{
+    long size = m_file->st.st_size;
+    int header_start = m_write->out.size();
+    /*所有区间都不可满足*/
+    if (count < 0)
+    {
+        if (!add_status_line(416, error_416_title) || !add_response("Content-Range:bytes */%ld\r\n", size) ||
+            !add_headers(0))
+        {
+            return false;
+        }
+        push_response(header_start, 0, 0);
+        return true;
+    }
+    if (count == 1)
+    {
+        if (!add_status_line(206, partial_206_title) ||
+            !add_response("Accept-Ranges:bytes\r\nContent-Range:bytes %ld-%ld/%ld\r\n",
+                          (long)starts[0], (long)(starts[0] + lens[0] - 1), size) || !add_validators() ||
+            !add_response("Content-Length:%ld\r\n", (long)lens[0]) || !add_linger() || !add_blank_line())
+        {
+            return false;
+        }
+        push_response(header_start, starts[0], lens[0]);
+        return true;
+    }
+
+    /*先算出消息体的总长度：区间头和结尾分隔符的长度加上所有区间的长度。
+    除第一个之外，区间头以结束上一个区间的CRLF开头*/
+    const char *part_format = "%s--%s\r\nContent-Range:bytes %ld-%ld/%ld\r\n\r\n";
+    const char *end_format = "\r\n--%s--\r\n";
+    long total = snprintf(NULL, 0, end_format, range_boundary);
+    for (int i = 0; i < count; i++)
+    {
+        total += snprintf(NULL, 0, part_format, i == 0 ? "" : "\r\n", range_boundary,
+                          (long)starts[i], (long)(starts[i] + lens[i] - 1), size);
+        total += lens[i];
+    }
+    if (!add_status_line(206, partial_206_title) ||
+        !add_response("Accept-Ranges:bytes\r\nContent-Type:multipart/byteranges; boundary=%s\r\n", range_boundary) ||
+        !add_validators() ||
+        !add_response("Content-Length:%ld\r\n", total) || !add_linger() || !add_blank_line())
+    {
+        return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (!add_response(part_format, i == 0 ? "" : "\r\n", range_boundary,
+                          (long)starts[i], (long)(starts[i] + lens[i] - 1), size))
+        {
+            return false;
+        }
+        push_response(header_start, starts[i], lens[i]);
+        header_start = m_write->out.size();
+    }
+    if (!add_response(end_format, range_boundary))
+    {
+        return false;
+    }
+    push_response(header_start, 0, 0);
     return true;
-}
\ No newline at end of file
+}
@@ -18,16 +18,31 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <string.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 
 #include "locker.h"
+#include "filecache.h"
+#include "objpool.h"
+#include "buffer.h"
+#include "timewheel.h"
+#include "stats.h"
+#include "bodydecoder.h"
+#include "tcptune.h"
+#include "vhost.h"
+#include "handler.h"
+#include "trace.h"
+#include "ratelimit.h"
 
 class HTTPConn
 {
@@ -35,11 +50,30 @@ class HTTPConn
 public:
     /*文件名的最大长度*/
     static const int FILENAME_LEN = 200;
-    /*读缓冲区的大小*/
+    /*读缓冲区的初始大小，请求处理完后缩回这个大小*/
     static const int READ_BUFFER_SIZE = 2048;
-    /*写缓冲区的大小*/
-    static const int WRITE_BUFFER_SIZE = 1024;
-    /*HTTP请求方法，但我们仅支持GET*/
+    /*读缓冲区最大可以增长到的大小，超过这个大小的请求头被拒绝*/
+    static const int MAX_READ_BUFFER_SIZE = 65536;
+    /*读缓冲区尾部不够时，readv把多出来的数据先读到栈上的这块空间*/
+    static const int EXTRA_READ_SIZE = 16384;
+    /*流水线中最多同时排队等待发送的响应数*/
+    static const int MAX_PIPELINE = 16;
+    /*一个Range请求最多的区间数，超过时忽略Range，发送整个文件*/
+    static const int MAX_RANGES = 8;
+    /*响应队列的长度：multipart/byteranges响应的每个区间占用一项，另有一项是结尾的分隔符*/
+    static const int MAX_RESPONSES = MAX_PIPELINE + MAX_RANGES + 1;
+    /*写缓冲区剩余空间不足以容纳一个响应头（或一个错误页面、一组multipart的区间头）时，不再解析后续的请求*/
+    static const int MIN_RESPONSE_SPACE = 1024;
+    /*一次writev最多使用的内存块数*/
+    static const int MAX_IOV = MAX_RESPONSES * 2 + ChainBuffer::MAX_SEGMENTS;
+    /*平滑升级时旧进程保留空闲长连接的时间（毫秒）*/
+    static const int DRAIN_IDLE_TIMEOUT = 1000;
+    /*路由请求的消息体在内存中收集，最大的字节数*/
+    static const int MAX_HANDLER_BODY = 1 << 20;
+    /*服务器自带的处理函数（统计结果、跟踪记录）的路径前缀，所有网站共享，网站自己的路由不能使用*/
+    static constexpr const char *ROUTE_PREFIX = "/_server/";
+    static const int ROUTE_PREFIX_LEN = 9;
+    /*HTTP请求方法。静态文件只支持GET，以及配置了上传目录时的PUT；其他方法只能用于注册了处理函数的路径*/
     enum METHOD
     {
         GET = 0,
@@ -50,7 +84,8 @@ public:
         TRACE,
         OPTIONS,
         CONNECT,
-        PATCH
+        PATCH,
+        METHOD_NUM
     };
     /*解析客户请求时，主状态机所处的状态*/
     enum CHECK_STATE
@@ -68,9 +103,24 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        NOT_MODIFIED,
+        HANDLER_REQUEST,
+        NOT_ALLOWED,
+        TOO_MANY_REQUESTS,
+        TOO_LARGE,
+        UPLOAD_REQUEST,
         INTERNAL_ERROR,
         CLOSED_CONNECTION
     };
+    /*连接所处的阶段，每个阶段有各自的超时时间*/
+    enum PHASE
+    {
+        PHASE_HEADER = 0, //等待完整的请求头：从请求的第一个字节（新连接从accept）开始计时，慢慢发送请求头也会超时
+        PHASE_BODY,       //接收请求的消息体：两次收到数据之间的间隔
+        PHASE_IDLE,       //空闲的长连接：从上一批响应发送完开始计时
+        PHASE_WRITE,      //发送响应：两次发送出数据之间的间隔
+        PHASE_NUM
+    };
     /*行的读取状态*/
     enum LINE_STATUS
     {
@@ -80,23 +130,129 @@ public:
     };
 
 public:
-    HTTPConn() {}
+    HTTPConn() : m_sockfd(-1), m_write(nullptr), m_body_fd(-1), m_busy(false) {}
     ~HTTPConn() {}
 
-    //初始化客户连接
-    void init(int sockfd, const sockaddr_in &addr);
+    //从连接对象池中取出一个连接对象，连接关闭时自动放回对象池
+    static HTTPConn *new_conn();
+    /*初始化客户连接，epollfd是负责该连接的事件循环的epoll句柄，为-1时连接不注册到epoll（io_uring后端）。
+    one_shot为true时连接注册为EPOLLONESHOT，在事件循环和工作线程之间传递，每次处理完都要重新注册；
+    为false时连接只由事件循环线程处理（--exec inline），只在读写方向改变时修改注册的事件。
+    counted是admit的结果，为true时连接关闭时从对方地址的连接数中减去*/
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, bool one_shot = true, bool counted = false);
     //关闭连接
     void close_conn(bool real_close = true);
+    //只shutdown socket，不关闭连接：事件循环随后收到EPOLLHUP（或者请求完成），由它关闭连接
+    void shutdown_conn() { shutdown(m_sockfd, SHUT_RDWR); }
     //处理客户请求
     void process();
+    //事件循环线程自己解析请求并立即发送响应（--exec inline），返回false表示应关闭连接
+    bool process_inline();
+    //过载时拒绝客户请求：不解析，直接回复预先生成的503响应，发送完之后关闭连接
+    void shed();
+    //生成过载时使用的503响应，seconds是Retry-After的值
+    static void set_retry_after(int seconds);
+    //设置虚拟主机表，请求按Host头部字段在其中选择网站。网站可以有自己的消息体超时，在set_timeouts之后调用
+    static void set_hosts(const HostTable *hosts);
+    /*注册处理函数：方法为method、路径匹配pattern（见router.h）的请求交给handler处理。
+    host是主机表中的主机名（"default"表示默认主机）时路由只属于这个网站，pattern可以是任何应用路径，
+    只遮住这个网站中的同名文件，但不能在ROUTE_PREFIX之下；host为空时是所有网站共享的服务器路由，
+    pattern必须在ROUTE_PREFIX之下。只能在set_hosts之后、启动服务之前调用，
+    模式不合法、前缀不符合上面的要求或者主机名不在表中时返回false*/
+    static bool add_route(METHOD method, const char *pattern, Handler handler, const char *host = nullptr);
+    /*平滑升级：监听socket已经交给新进程，之后的响应都带Connection:close，空闲的长连接很快关闭。
+    任何线程都可以调用*/
+    static void set_draining() { m_draining.store(true, std::memory_order_relaxed); }
+    //设置按客户端地址的限制，为空时不限制
+    static void set_rate_limiter(RateLimiter *limiter);
+    /*accept之后、取出连接对象之前调用：按对方地址检查并发连接数和请求速率，超过限制时回复429、关闭cfd，返回false。
+    counted表示连接计入了这个地址的连接数，要传给init；连接没有建立起来时调用release_admit*/
+    static bool admit(int cfd, const sockaddr_in &addr, long now, bool &counted);
+    static void release_admit(const sockaddr_in &addr, bool counted);
+    //设置新连接上不能从监听socket继承的TCP选项
+    static void set_tcp_profile(const TcpProfile &profile) { m_tcp_profile = profile; }
     //非阻塞读
     bool Read();
     //非阻塞写
     bool Write();
 
+    /*下面这组函数不涉及具体的I/O方式，epoll后端在Read/process/Write中使用，
+    io_uring后端由事件循环提交I/O，完成后直接调用它们*/
+    //把收到的数据追加到读缓冲区，超过读缓冲区的上限时返回false
+    bool feed(const char *data, int len);
+    //解析读缓冲区中的所有完整请求并生成响应，返回false表示应关闭连接
+    bool handle_requests();
+    //响应队列中是否还有未发送完的数据
+    bool response_pending() const { return m_response_idx < m_response_count; }
+    //当前发送位置处于sendfile发送的消息体时返回true，并给出文件描述符、文件偏移和剩余长度
+    bool sendfile_range(int &fd, off_t &offset, off_t &len) const;
+    //从当前发送位置开始，把连续的内存数据填入iovec数组，遇到sendfile发送的消息体时停止并设置more
+    int prepare_iov(bool &more);
+    struct iovec *iov() { return m_write->iv; }
+    //发送了n字节之后推进发送位置，释放已经发送完的响应所持有的缓存项
+    void consume(int n);
+    //整批响应发送完毕后的收尾，读缓冲区中还有后续请求时继续解析，返回false表示应关闭连接
+    bool finish_batch();
+
+    /*空闲超时。连接由所属的事件循环放在它的时间轮上，下面这组函数只由事件循环线程调用*/
+    //设置各阶段的超时时间（毫秒），0表示不限制
+    static void set_timeouts(int header, int body, int idle, int write);
+    //各阶段中最短的超时时间，全部不限制时为0，这时事件循环不使用时间轮
+    static int min_timeout() { return m_min_timeout; }
+    TimeWheelTimer *timer() { return &m_timer; }
+    /*连接上有活动（收到或者发送了数据），在处理这次活动之前调用。返回定时器应该在多少毫秒之后检查：
+    当前阶段的剩余时间（慢慢发送的请求头不会因为有活动而推迟超时），但不超过最短的超时时间，
+    因为处理完这次活动之后连接可能进入超时时间更短的阶段*/
+    int touch(long now);
+    //检查连接是否超时，没有超时时通过remain返回距离超时还有多少毫秒
+    bool expired(long now, int &remain) const;
+    //交给线程池处理之前调用；工作线程处理完之前，连接的状态不能被事件循环读取
+    void dispatch() { m_busy.store(true, std::memory_order_relaxed); }
+    bool busy() const { return m_busy.load(std::memory_order_acquire); }
+
+private:
+    /*一个已经生成、等待发送的响应：响应头（以及错误页面的内容）在写缓冲区中，文件消息体来自文件缓存。
+    multipart/byteranges响应由多项组成，每项是一个区间头加上文件中的一段*/
+    struct Response
+    {
+        int header_start;  //响应头在写缓冲区中的起始偏移
+        int header_len;    //响应头的长度
+        FileEntryPtr file; //消息体所在的缓存项，没有文件消息体时为空
+        off_t offset;      //消息体在文件中的起始偏移
+        off_t body_len;    //消息体的长度
+        bool linger;       //发送完之后是否保持连接
+    };
+    /*写缓冲区和响应队列，只在连接有待发送的响应时从对象池借用*/
+    struct WriteBuffer
+    {
+        /*响应头和错误页面，由1KB的内存块串成，按需增长*/
+        ChainBuffer out;
+        /*流水线中的多个请求依次生成的响应*/
+        Response responses[MAX_RESPONSES];
+        /*我们将采用writev来执行写操作，每个响应占用一个消息体内存块，响应头跨越内存块时会多占用几个*/
+        struct iovec iv[MAX_IOV];
+    };
+
 private:
     //初始化连接，私有方法
     void init();
+    //工作线程处理完毕，清除m_busy并重新注册事件
+    void rearm(int event);
+    //等待event事件：EPOLLONESHOT的连接每次都要重新注册，否则只在事件改变时修改
+    void wait_for(int event);
+    //根据解析和发送的状态判断连接所处的阶段
+    PHASE phase() const;
+    //一个请求处理完毕，为解析下一个请求重置状态，读缓冲区中已有的数据保留
+    void reset_request();
+    //把读缓冲区中尚未处理的数据移到缓冲区开头，读缓冲区曾经增长过时缩回初始大小
+    void compact_read_buf();
+    //读缓冲区换了内存块（old_base）或数据前移了shift字节之后，修正指向读缓冲区的指针
+    void rebase_read_ptrs(const char *old_base, int shift);
+    //从缓冲池借用和归还读写缓冲区，空闲的长连接不占用缓冲区
+    bool acquire_read_buf();
+    void release_read_buf();
+    bool acquire_write_buf();
+    void release_write_buf();
 
     //解析HTTP请求
     HTTP_CODE process_read();
@@ -104,67 +260,157 @@ private:
     LINE_STATUS parse_line();
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
-    HTTP_CODE parse_content(char *text);
+    HTTP_CODE parse_content();
+    //请求头解析完毕，根据Content-Length或Transfer-Encoding准备接收消息体
+    HTTP_CODE begin_body();
+    //消息体接收完毕（或者没有消息体），处理请求
+    HTTP_CODE end_request();
     HTTP_CODE do_request();
-    char *get_line() { return m_read_buf + m_start_line; }
+    //PUT请求的消息体已经全部写入临时文件，把它链接到上传目录中
+    HTTP_CODE do_upload();
+    //关闭还没有链接到上传目录中的临时文件，其中的数据随之丢弃
+    void release_body();
+    //调用匹配的处理函数，把它生成的响应拼成一个完整的响应，作为内存中的消息体
+    HTTP_CODE do_handler();
+    //根据If-None-Match和If-Modified-Since判断客户端缓存的副本是否仍然有效
+    bool not_modified() const;
+    //If-Range与当前文件不符时，Range被忽略
+    bool if_range_match() const;
+    //目标文件有客户端接受的预压缩副本时，把m_file换成其中q值最高的一个
+    void select_encoding();
+    char *get_line() { return m_read_buf.data() + m_start_line; }
 
     //生成HTTP响应
     bool process_write(HTTP_CODE res);
+    //文件请求带有可满足的Range时，生成206（或416）响应；返回false表示写缓冲区空间不足
+    bool process_range(int count, const off_t *starts, const off_t *lens);
+    //把写缓冲区中从header_start开始的响应头，连同文件中[offset, offset+body_len)的消息体加入响应队列
+    void push_response(int header_start, off_t offset, off_t body_len);
     //下面这一组函数被process_response调用以生成HTTP响应
-    void unmap();
+    void release_file();
+    //消息体是否用sendfile从缓存的文件描述符发送：没有常驻内存副本的文件走sendfile
+    static bool use_sendfile(const Response &r) { return r.body_len > 0 && !r.file->data; }
+    //清空响应队列
+    void clear_responses();
     bool add_response(const char *format, ...);
+    bool add_block(const char *data, int len);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
     bool add_headers(int content_length);
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    bool add_validators();
 
 public:
-    /*所有socket上的事件都被注册到同一个epoll内核事件表中，所以将epoll文件描述符设置为静态的*/
-    static int m_epollfd;
-    /*统计用户数量*/
-    static int m_user_count;
+    /*统计用户数量，多个事件循环线程会同时修改*/
+    static std::atomic<int> m_user_count;
+
+private:
+    /*连接对象池和写缓冲区对象池，所有事件循环和工作线程共享；读缓冲区的内存块来自BufferPool*/
+    static ObjectPool<HTTPConn> m_conn_pool;
+    static ObjectPool<WriteBuffer> m_write_pool;
+    /*各阶段的超时时间（毫秒）和其中最短的一个*/
+    static int m_timeouts[PHASE_NUM];
+    static int m_min_timeout;
+    /*虚拟主机表，启动之后只读*/
+    static const HostTable *m_hosts;
+    /*路由表：路径模式对应各方法的处理函数，启动之后只读。m_routes是ROUTE_PREFIX之下的服务器路由，
+    m_site_routes是各网站自己的路由表，没有注册路由的网站不在其中*/
+    struct Route
+    {
+        Handler handlers[METHOD_NUM];
+    };
+    static Router<Route> m_routes;
+    static std::unordered_map<const VirtualHost *, std::unique_ptr<Router<Route>>> m_site_routes;
+    /*进程正在为平滑升级退出*/
+    static std::atomic<bool> m_draining;
+    /*监听socket的TCP调优参数，init时设置其中不能继承的选项*/
+    static TcpProfile m_tcp_profile;
+    /*按客户端地址的限制，为空时不限制*/
+    static RateLimiter *m_limiter;
 
 private:
+    /*该连接所属事件循环的epoll句柄，多Reactor模式下每个事件循环有各自的epoll内核事件表*/
+    int m_epollfd;
     /*该HTTP连接的socket和对方的socket地址*/
     int m_sockfd;
     sockaddr_in m_address;
-    /*读缓冲区*/
-    char m_read_buf[READ_BUFFER_SIZE];
+    /*连接是否计入了对方地址的连接数*/
+    bool m_counted;
+    /*读缓冲区，只在连接有待处理的数据时从缓冲池借用；请求头很长时换成更大的内存块*/
+    FlatBuffer m_read_buf;
     /*标识读缓冲中已经读入的客户数据的最后一个字节的下一个位置*/
     int m_read_idx;
     /*当前正在分析的字符在读缓冲区中的位置*/
     int m_checked_idx;
     /*当前正在解析的行的起始位置*/
     int m_start_line;
-    /*写缓冲区*/
-    char m_write_buf[WRITE_BUFFER_SIZE];
-    /*写缓冲区中待发送的字节数*/
-    int m_write_idx;
+    /*当前正在解析的请求的起始位置，之前的数据都已经处理完，可以被覆盖*/
+    int m_request_start;
+    /*写缓冲区和响应队列，没有借用时为空*/
+    WriteBuffer *m_write;
     /*主状态机当前所处的状态*/
     CHECK_STATE m_check_state;
     /*请求方法*/
     METHOD m_method;
-    /*客户请求的目标文件的完整路径，其内容等于doc_root+m_url，doc_root是网站根目录*/
-    char m_real_file[FILENAME_LEN];
     /*客户请求的目标文件的文件名*/
     char *m_url;
     /*HTTP协议版本号，我们仅支持HTTP/1.1*/
     char *m_version;
-    /*主机名*/
+    /*主机名，以及请求头解析完之后据此选出的网站*/
     char *m_host;
-    /*HTTP请求的消息体的长度*/
-    int m_content_length;
+    const VirtualHost *m_vhost;
+    /*Range、If-Range、If-None-Match、If-Modified-Since、Accept-Encoding头部字段的值，没有时为空*/
+    char *m_range;
+    char *m_if_range;
+    char *m_if_none_match;
+    char *m_if_modified_since;
+    char *m_accept_encoding;
+    /*HTTP请求的消息体的长度，以及是否使用chunked传输编码*/
+    long m_content_length;
+    /*请求中出现过Content-Length（值可以为0），与Transfer-Encoding同时出现时拒绝*/
+    bool m_has_content_length;
+    /*已经解码的消息体字节数，chunked编码时按它检查网站的max-body*/
+    long m_body_size;
+    bool m_chunked;
+    /*消息体解码器：消息体在读缓冲区中原地解码，解码出的数据写入m_body_fd（PUT的临时文件）
+    或者直接丢弃，随后从读缓冲区中删除，所以任意大的消息体只占用一个读缓冲区*/
+    BodyDecoder m_body;
+    int m_body_fd;
+    /*请求路径匹配的路由和其中本方法的处理函数，没有时为空；路径模式中的变量匹配到的部分；
+    路由请求的消息体不写文件，收集在m_body_data中*/
+    const Route *m_route;
+    const Handler *m_handler;
+    RouteParams m_params;
+    std::string m_body_data;
+    /*处理函数生成的响应的状态码*/
+    int m_handler_status;
+    /*请求速率超过限制时，429响应中Retry-After的值（秒）*/
+    int m_limit_wait;
     /*HTTP请求是否要求保持连接*/
     bool m_linger;
-    /*客户请求的目标文件被mmap到内存中的起始位置*/
-    char *m_file_address;
-    /*目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息*/
-    struct stat m_file_stat;
-    /*我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量*/
-    struct iovec m_iv[2];
-    int m_iv_count;
+    /*目标文件在文件缓存中的缓存项，包含文件描述符、文件属性和小文件的常驻内存副本。
+    生成响应时转交给响应队列，响应发送完之前一直持有引用，保证文件描述符不会被关闭*/
+    FileEntryPtr m_file;
+    /*响应队列中的响应数，m_response_idx是正在发送的响应，
+    m_response_sent是它已经发送的字节数，遇到EAGAIN后从这里继续*/
+    int m_response_count;
+    int m_response_idx;
+    off_t m_response_sent;
+    /*连接在所属事件循环的时间轮上的定时器*/
+    TimeWheelTimer m_timer;
+    /*上次活动的时间和当前请求开始的时间（毫秒），以及该连接上已经处理的请求数*/
+    long m_active;
+    long m_request_time;
+    int m_requests;
+    /*连接是否注册为EPOLLONESHOT，以及当前注册的事件（EPOLLIN或EPOLLOUT）*/
+    bool m_one_shot;
+    int m_event;
+    /*读缓冲区达到上限而暂停读取，socket中可能还有数据。边沿触发不会再通知这些数据，需要重新注册让epoll重新检查*/
+    bool m_read_full;
+    /*连接是否在线程池中处理：由事件循环置位，工作线程处理完、重新注册事件之前清除*/
+    std::atomic<bool> m_busy;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+/**
+  * @file    :httpscan.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :HTTP请求的扫描函数：向量化地查找行结束符，以及按长度分派的头部字段名查找。
+  * 行扫描有AVX2（每次32字节）、SSE4.2（每次16字节）和逐字节三种实现，程序启动时根据CPU支持的指令集选择一种
+*/
+
+#ifndef __HTTPSCAN_H
+#define __HTTPSCAN_H
+
+#include <string.h>
+#include <strings.h>
+#include <immintrin.h>
+
+/*行扫描函数：在[p, end)中查找第一个'\r'或'\n'，找不到时返回end*/
+typedef const char *(*line_scan_fn)(const char *p, const char *end);
+
+//逐字节扫描，任何CPU都可以使用
+inline const char *find_line_end_scalar(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == '\r' || *p == '\n')
+        {
+            return p;
+        }
+    }
+    return end;
+}
+
+//SSE4.2：PCMPESTRI一次比较16个字节是否等于"\r\n"中的任意一个
+__attribute__((target("sse4.2"))) inline const char *find_line_end_sse42(const char *p, const char *end)
+{
+    const __m128i needle = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i data = _mm_loadu_si128((const __m128i *)p);
+        int idx = _mm_cmpestri(needle, 2, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+        {
+            return p + idx;
+        }
+    }
+    return find_line_end_scalar(p, end);
+}
+
+//AVX2：一次比较32个字节，两个比较结果合并成位掩码，最低的置位就是第一个行结束符
+__attribute__((target("avx2"))) inline const char *find_line_end_avx2(const char *p, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i data = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(data, cr), _mm256_cmpeq_epi8(data, lf));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_line_end_scalar(p, end);
+}
+
+//根据CPU支持的指令集选择行扫描函数
+inline line_scan_fn select_line_scan()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return find_line_end_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return find_line_end_sse42;
+    }
+    return find_line_end_scalar;
+}
+
+//程序启动时选定的行扫描函数
+inline line_scan_fn &line_scan_impl()
+{
+    static line_scan_fn impl = select_line_scan();
+    return impl;
+}
+
+/*在[p, end)中查找第一个'\r'或'\n'，找不到时返回end*/
+inline const char *find_line_end(const char *p, const char *end)
+{
+    return line_scan_impl()(p, end);
+}
+
+/*服务器关心的请求头部字段*/
+enum HEADER_ID
+{
+    HEADER_UNKNOWN = 0,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_HOST,
+    HEADER_RANGE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_RANGE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT_ENCODING
+};
+
+/*根据头部字段名查找字段：先按名字长度分派，每个长度只需一两次不区分大小写的比较，
+而不是对所有已知字段依次strncasecmp。name不包含冒号*/
+inline HEADER_ID lookup_header(const char *name, int len)
+{
+    switch (len)
+    {
+    case 4:
+        return strncasecmp(name, "Host", 4) == 0 ? HEADER_HOST : HEADER_UNKNOWN;
+    case 5:
+        return strncasecmp(name, "Range", 5) == 0 ? HEADER_RANGE : HEADER_UNKNOWN;
+    case 8:
+        return strncasecmp(name, "If-Range", 8) == 0 ? HEADER_IF_RANGE : HEADER_UNKNOWN;
+    case 10:
+        return strncasecmp(name, "Connection", 10) == 0 ? HEADER_CONNECTION : HEADER_UNKNOWN;
+    case 13:
+        return strncasecmp(name, "If-None-Match", 13) == 0 ? HEADER_IF_NONE_MATCH : HEADER_UNKNOWN;
+    case 14:
+        return strncasecmp(name, "Content-Length", 14) == 0 ? HEADER_CONTENT_LENGTH : HEADER_UNKNOWN;
+    case 15:
+        return strncasecmp(name, "Accept-Encoding", 15) == 0 ? HEADER_ACCEPT_ENCODING : HEADER_UNKNOWN;
+    case 17:
+        if (strncasecmp(name, "If-Modified-Since", 17) == 0)
+        {
+            return HEADER_IF_MODIFIED_SINCE;
+        }
+        return strncasecmp(name, "Transfer-Encoding", 17) == 0 ? HEADER_TRANSFER_ENCODING : HEADER_UNKNOWN;
+    default:
+        return HEADER_UNKNOWN;
+    }
+}
+
+#endif
@@ -0,0 +1,89 @@
+/**
+  * @file    :objpool.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :对象池模板类：按块（slab）一次分配多个对象，用完的对象放回空闲链表中复用。
+  * 用于连接对象和连接的读写缓冲区，需要时才分配，而不是启动时按最大连接数预先分配
+*/
+
+#ifndef __OBJPOOL_H
+#define __OBJPOOL_H
+
+#include <new>
+#include <vector>
+#include "locker.h"
+
+template <typename T>
+class ObjectPool
+{
+public:
+    /*slab_size是每次向系统申请的对象个数*/
+    explicit ObjectPool(int slab_size = 64) : m_slab_size(slab_size), m_allocated(0) {}
+    ~ObjectPool()
+    {
+        for (size_t i = 0; i < m_slabs.size(); i++)
+        {
+            delete[] m_slabs[i];
+        }
+    }
+
+    //取出一个对象，空闲链表为空时再分配一个slab
+    T *acquire()
+    {
+        m_lock.lock();
+        if (m_free.empty())
+        {
+            T *slab = new (std::nothrow) T[m_slab_size];
+            if (!slab)
+            {
+                m_lock.unlock();
+                return nullptr;
+            }
+            m_slabs.push_back(slab);
+            m_allocated += m_slab_size;
+            for (int i = m_slab_size - 1; i >= 0; i--)
+            {
+                m_free.push_back(slab + i);
+            }
+        }
+        T *obj = m_free.back();
+        m_free.pop_back();
+        m_lock.unlock();
+        return obj;
+    }
+
+    //归还对象，对象的状态由使用者负责重置
+    void release(T *obj)
+    {
+        m_lock.lock();
+        m_free.push_back(obj);
+        m_lock.unlock();
+    }
+
+    //已经分配的对象总数
+    int allocated()
+    {
+        m_lock.lock();
+        int n = m_allocated;
+        m_lock.unlock();
+        return n;
+    }
+
+    //空闲链表中的对象数
+    int available()
+    {
+        m_lock.lock();
+        int n = m_free.size();
+        m_lock.unlock();
+        return n;
+    }
+
+private:
+    locker m_lock;           //保护空闲链表
+    int m_slab_size;         //每个slab的对象个数
+    int m_allocated;         //已经分配的对象总数
+    std::vector<T *> m_slabs; //所有slab，析构时释放
+    std::vector<T *> m_free;  //空闲对象
+};
+
+#endif
@@ -0,0 +1,45 @@
+#!/bin/sh
+# @file    :precompress.sh
+# @author  :zhl
+# @date    :2026-10-17
+# @desc    :为网站根目录下的文本文件生成预压缩副本file.gz（安装了brotli时另外生成file.br），
+# 服务器根据请求的Accept-Encoding直接发送副本，不在请求时压缩。
+# 只重新生成比原文件旧的副本，压缩后没有变小的文件不保留副本。可以在发布之后运行一次，也可以放进cron定期运行，
+# 服务器在缓存项的有效期到期、重新校验时发现新的副本
+# 用法：./precompress.sh [docroot] [min_size]，默认/var/www/html，小于min_size（默认256）字节的文件不压缩
+
+root=${1:-/var/www/html}
+min=${2:-256}
+
+# 压缩一个文件：$1是原文件，$2是副本的后缀，之后是输出到标准输出的压缩命令
+compress() {
+  src=$1
+  out=$1.$2
+  shift 2
+  # 副本不比原文件旧，不需要重新生成
+  if [ -e "$out" ] && ! [ "$src" -nt "$out" ]; then
+    return
+  fi
+  # 先写临时文件再rename，服务器不会读到写了一半的副本
+  tmp=$out.tmp.$$
+  if ! "$@" "$src" > "$tmp"; then
+    rm -f "$tmp"
+    return
+  fi
+  if [ "$(wc -c < "$tmp")" -lt "$(wc -c < "$src")" ]; then
+    chmod 644 "$tmp"
+    mv -f "$tmp" "$out"
+    echo "$out"
+  else
+    rm -f "$tmp" "$out"
+  fi
+}
+
+find "$root" -type f -size +"$min"c \( -name '*.html' -o -name '*.htm' -o -name '*.css' -o -name '*.js' -o -name '*.mjs' \
+  -o -name '*.json' -o -name '*.svg' -o -name '*.xml' -o -name '*.txt' -o -name '*.csv' -o -name '*.wasm' \) |
+while IFS= read -r f; do
+  compress "$f" gz gzip -9 -n -c
+  if command -v brotli > /dev/null 2>&1; then
+    compress "$f" br brotli -q 11 -c
+  fi
+done
@@ -0,0 +1,252 @@
+/**
+  * @file    :ratelimit.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :ratelimit.h的源文件
+  */
+
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "ratelimit.h"
+
+/*令牌桶容量的上限（个），容量以千分之一个为单位保存在32位中*/
+static const int MAX_BURST = 1000000;
+
+RateLimiter::RateLimiter(int rate, int burst, int max_conns, int entries)
+    : m_buckets(nullptr), m_bits(0)
+{
+    if (rate < 0)
+    {
+        rate = 0;
+    }
+    if (burst <= 0)
+    {
+        burst = rate;
+    }
+    if (burst > MAX_BURST)
+    {
+        burst = MAX_BURST;
+    }
+    m_rate = rate > MAX_BURST ? MAX_BURST : rate;
+    m_capacity = m_rate ? burst * 1000 : 0;
+    m_max_conns = max_conns > 0 ? max_conns : 0;
+    //桶数取能放下entries个地址的2的幂
+    while ((1L << m_bits) * BUCKET_ENTRIES < entries && m_bits < 30)
+    {
+        m_bits++;
+    }
+    m_buckets = new Bucket[1L << m_bits]();
+    if (getrandom(m_seeds, sizeof(m_seeds), GRND_NONBLOCK) != sizeof(m_seeds))
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        m_seeds[0] = ts.tv_nsec ^ (getpid() << 16) ^ 0x9e3779b9;
+        m_seeds[1] = (m_seeds[0] * 0x85ebca6b) ^ ts.tv_sec;
+    }
+    m_seeds[0] |= 1;
+    m_seeds[1] |= 1;
+}
+
+RateLimiter::~RateLimiter()
+{
+    delete[] m_buckets;
+}
+
+void RateLimiter::lock_bucket(Bucket *b)
+{
+    /*临界区只有几十条指令，自旋等待；持有者被调度出去时让出CPU，避免单核上空转一个时间片*/
+    while (b->lock.exchange(1, std::memory_order_acquire))
+    {
+        for (int spins = 0; b->lock.load(std::memory_order_relaxed); spins++)
+        {
+            if (spins >= 64)
+            {
+                sched_yield();
+            }
+        }
+    }
+}
+
+RateLimiter::Slots RateLimiter::lock(uint32_t addr)
+{
+    Bucket *a = &m_buckets[(uint64_t)(uint32_t)(addr * m_seeds[0]) >> (32 - m_bits)];
+    Bucket *b = &m_buckets[(uint64_t)(uint32_t)(addr * m_seeds[1]) >> (32 - m_bits)];
+    if (a == b)
+    {
+        lock_bucket(a);
+        return {a, nullptr};
+    }
+    //两个桶总是按地址从低到高加锁
+    lock_bucket(a < b ? a : b);
+    lock_bucket(a < b ? b : a);
+    return {a, b};
+}
+
+void RateLimiter::unlock(const Slots &s)
+{
+    if (s.second)
+    {
+        unlock_bucket(s.second);
+    }
+    unlock_bucket(s.first);
+}
+
+void RateLimiter::refill(Entry *e, uint32_t now) const
+{
+    uint64_t tokens = e->tokens + (uint64_t)(uint32_t)(now - e->stamp) * m_rate;
+    e->tokens = tokens > m_capacity ? m_capacity : tokens;
+    e->stamp = now;
+}
+
+RateLimiter::Entry *RateLimiter::lookup(Bucket *b, uint32_t addr)
+{
+    for (int i = 0; i < BUCKET_ENTRIES; i++)
+    {
+        if (b->entries[i].addr == addr)
+        {
+            return &b->entries[i];
+        }
+    }
+    return nullptr;
+}
+
+RateLimiter::Entry *RateLimiter::find(const Slots &s, uint32_t addr, uint32_t now)
+{
+    Entry *e = lookup(s.first, addr);
+    if (!e && s.second)
+    {
+        e = lookup(s.second, addr);
+    }
+    if (e)
+    {
+        refill(e, now);
+        return e;
+    }
+    /*空项优先；其次是令牌最多的无连接项，没有连接、令牌已经补满的项与不存在等价，
+    令牌没有补满的项被覆盖时它欠下的令牌被遗忘，只在表装不下所有活跃地址时发生。
+    先看有连接的项较少的桶，同等的项留在这个桶中，两个桶的负载保持均衡*/
+    Bucket *order[2] = {s.first, s.second};
+    if (s.second)
+    {
+        int pinned[2] = {0, 0};
+        for (int k = 0; k < 2; k++)
+        {
+            for (int i = 0; i < BUCKET_ENTRIES; i++)
+            {
+                pinned[k] += order[k]->entries[i].conns != 0;
+            }
+        }
+        if (pinned[1] < pinned[0])
+        {
+            order[0] = s.second;
+            order[1] = s.first;
+        }
+    }
+    Entry *victim = nullptr;
+    for (int k = 0; k < 2 && order[k]; k++)
+    {
+        for (int i = 0; i < BUCKET_ENTRIES; i++)
+        {
+            Entry *c = &order[k]->entries[i];
+            if (c->addr == 0)
+            {
+                if (!victim || victim->addr != 0)
+                {
+                    victim = c;
+                }
+                continue;
+            }
+            if (c->conns != 0 || (victim && victim->addr == 0))
+            {
+                continue;
+            }
+            refill(c, now);
+            if (!victim || c->tokens > victim->tokens)
+            {
+                victim = c;
+            }
+        }
+    }
+    if (victim)
+    {
+        victim->addr = addr;
+        victim->stamp = now;
+        victim->tokens = m_capacity;
+        victim->conns = 0;
+    }
+    return victim;
+}
+
+RateLimiter::ADMIT RateLimiter::open_conn(const sockaddr_in &addr, long now)
+{
+    uint32_t key = addr.sin_addr.s_addr;
+    //没有得到对方地址（0.0.0.0是空项的标记）时不限制
+    if (key == 0)
+    {
+        return UNTRACKED;
+    }
+    Slots s = lock(key);
+    Entry *e = find(s, key, now);
+    /*只有计入连接数的项不会被覆盖，所以没有位置只在限制连接数、两个候选桶的项都有连接时发生*/
+    ADMIT ret = SATURATED;
+    if (e)
+    {
+        ret = UNTRACKED;
+        if ((m_max_conns && e->conns >= m_max_conns) || (m_rate && e->tokens < 1000))
+        {
+            ret = REJECTED;
+        }
+        else if (m_max_conns)
+        {
+            e->conns++;
+            ret = COUNTED;
+        }
+    }
+    unlock(s);
+    return ret;
+}
+
+void RateLimiter::close_conn(const sockaddr_in &addr)
+{
+    uint32_t key = addr.sin_addr.s_addr;
+    Slots s = lock(key);
+    Entry *e = lookup(s.first, key);
+    if (!e && s.second)
+    {
+        e = lookup(s.second, key);
+    }
+    if (e && e->conns > 0)
+    {
+        e->conns--;
+    }
+    unlock(s);
+}
+
+int RateLimiter::take(const sockaddr_in &addr, long now)
+{
+    uint32_t key = addr.sin_addr.s_addr;
+    if (!m_rate || key == 0)
+    {
+        return 0;
+    }
+    Slots s = lock(key);
+    Entry *e = find(s, key, now);
+    int wait = 0;
+    if (e)
+    {
+        if (e->tokens >= 1000)
+        {
+            e->tokens -= 1000;
+        }
+        else
+        {
+            //补足一个令牌需要的毫秒数，向上取整到秒
+            uint32_t ms = (1000 - e->tokens + m_rate - 1) / m_rate;
+            wait = (ms + 999) / 1000;
+        }
+    }
+    unlock(s);
+    return wait;
+}
@@ -0,0 +1,96 @@
+/**
+  * @file    :ratelimit.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :按客户端IP地址的限制：每个地址的并发连接数（accept时检查），以及令牌桶限制的请求速率（每个请求检查）。
+  * 状态保存在固定大小的哈希表中：每个桶正好一个缓存行，包含一个自旋锁和3个地址的状态。每个地址由两个独立的哈希
+  * 选出两个候选桶（two-choice hashing），可以记录在其中任何一个，新地址放进有连接的项较少的那个，
+  * 一次查找最多访问两个缓存行，不分配内存。令牌按经过的时间补充（不需要定时扫描），没有连接、令牌已经补满的项
+  * 与不存在等价，被新地址覆盖，所以出现过的地址再多，内存也是固定的。只有两个候选桶的6项都有连接时新地址才无处记录，
+  * 这时拒绝它的连接（SATURATED），而不是不加限制地接受。默认的表大小下，即使MAX_FD个连接都来自不同地址，
+  * 这也几乎不会发生；哈希的乘数每个进程随机选取，客户端无法有意占满某个地址的候选桶
+*/
+
+#ifndef __RATELIMIT_H
+#define __RATELIMIT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <netinet/in.h>
+
+class RateLimiter
+{
+public:
+    /*accept时的检查结果*/
+    enum ADMIT
+    {
+        REJECTED = 0, //超过并发连接数，或者令牌已经用完
+        SATURATED,    //拒绝：限制连接数时两个候选桶的6项都有连接，没有位置记录这个地址，无法检查它的连接数
+        COUNTED,      //接受，连接计入了这个地址，关闭时要调用close_conn
+        UNTRACKED     //接受，连接没有计入：不限制连接数，或者没有得到对方地址
+    };
+
+    /*rate：每个地址每秒的请求数，0表示不限制请求速率；burst：令牌桶的容量（允许的突发请求数），0表示等于rate；
+    max_conns：每个地址的并发连接数，0表示不限制；entries：表中最多同时记录的地址数。内存分配失败时抛出std::bad_alloc*/
+    RateLimiter(int rate, int burst, int max_conns, int entries);
+    ~RateLimiter();
+    RateLimiter(const RateLimiter &) = delete;
+    RateLimiter &operator=(const RateLimiter &) = delete;
+
+    //新连接：检查并发连接数和令牌桶（不取走令牌），now是单调时钟（毫秒）
+    ADMIT open_conn(const sockaddr_in &addr, long now);
+    //open_conn返回COUNTED的连接关闭时调用
+    void close_conn(const sockaddr_in &addr);
+    //一个请求：取走一个令牌，返回0；令牌不足时返回下一个令牌补充到之前需要等待的秒数（至少为1，用于Retry-After）
+    int take(const sockaddr_in &addr, long now);
+
+    //表占用的内存（字节）
+    long memory() const { return (1L << m_bits) * sizeof(Bucket); }
+
+private:
+    /*一个地址的状态。令牌以千分之一个为单位：经过1毫秒补充rate个单位，不需要除法*/
+    struct Entry
+    {
+        uint32_t addr;   //网络字节序的IPv4地址，0表示空项
+        uint32_t stamp;  //上次补充令牌的时间（毫秒，截断为32位，相减时回绕也正确）
+        uint32_t tokens; //令牌数 * 1000
+        uint32_t conns;  //当前的连接数
+    };
+    static const int BUCKET_ENTRIES = 3;
+    struct alignas(64) Bucket
+    {
+        std::atomic<uint32_t> lock;
+        uint32_t pad[3];
+        Entry entries[BUCKET_ENTRIES];
+    };
+    static_assert(sizeof(Bucket) == 64, "a bucket should fill one cache line");
+
+    /*地址的两个候选桶，两个哈希选中同一个桶时second为空*/
+    struct Slots
+    {
+        Bucket *first;
+        Bucket *second;
+    };
+    //加锁并返回地址的两个候选桶，按桶的地址顺序加锁，两个线程不会互相等待
+    Slots lock(uint32_t addr);
+    static void unlock(const Slots &s);
+    static void lock_bucket(Bucket *b);
+    static void unlock_bucket(Bucket *b) { b->lock.store(0, std::memory_order_release); }
+    //在两个候选桶中查找地址并补充令牌。不存在时占用一项：空项、令牌最多的无连接项依次优先，
+    //同等时选有连接的项较少的桶；两个桶的项都有连接时返回空
+    Entry *find(const Slots &s, uint32_t addr, uint32_t now);
+    //在一个桶中查找地址
+    static Entry *lookup(Bucket *b, uint32_t addr);
+    //补充到now为止的令牌
+    void refill(Entry *e, uint32_t now) const;
+
+private:
+    Bucket *m_buckets;
+    int m_bits;           //桶数是2^m_bits，用哈希值的高m_bits位选择桶
+    uint32_t m_seeds[2];  //两个哈希的乘数（奇数），每个进程随机选取，客户端无法预先构造落在同一个桶中的地址
+    uint32_t m_rate;      //每毫秒补充的令牌单位数，0表示不限制请求速率
+    uint32_t m_capacity;  //令牌桶的容量（单位）
+    uint32_t m_max_conns; //0表示不限制连接数
+};
+
+#endif
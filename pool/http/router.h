@@ -0,0 +1,224 @@
+/**
+  * @file    :router.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :URL路由：把路径模式编译成基数树（radix trie），按请求路径查找对应的值。
+  * 模式由静态部分和两种变量组成：":name"匹配一个路径段（不含'/'），"*name"匹配剩下的全部路径（可以为空），
+  * 只能出现在模式末尾，变量名可以省略（只写"*"）。例如"/api/items/:id"匹配"/api/items/42"，
+  * "/static/"之后接"*file"匹配"/static/"之下的所有路径。同一位置静态部分优先，其次是":name"，最后是"*name"。
+  * 路由表在启动时建立，之后只读，多个线程同时查找不需要加锁
+*/
+
+#ifndef __ROUTER_H
+#define __ROUTER_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*查找时变量匹配到的部分。值记为相对于路径开头的偏移，读缓冲区换了内存块之后仍然有效*/
+struct RouteParams
+{
+    static const int MAX_PARAMS = 8;
+
+    struct Param
+    {
+        const char *name; //变量名，指向路由表中的字符串
+        int offset;       //值在路径中的偏移和长度
+        int len;
+    };
+    Param items[MAX_PARAMS];
+    int count;
+
+    RouteParams() : count(0) {}
+    //按名字查找变量，没有时返回空
+    const Param *find(const char *name) const
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (strcmp(items[i].name, name) == 0)
+            {
+                return &items[i];
+            }
+        }
+        return nullptr;
+    }
+};
+
+template <typename T>
+class Router
+{
+public:
+    Router() : m_root(new Node) {}
+    ~Router() { destroy(m_root); }
+    Router(const Router &) = delete;
+    Router &operator=(const Router &) = delete;
+
+    /*加入模式pattern，返回它的值的位置（已经存在时返回原来的位置）。
+    模式不以'/'开头、变量名为空、同一位置的变量名不一致、"*"不在末尾、变量超过MAX_PARAMS个时返回空*/
+    T *insert(const char *pattern)
+    {
+        if (pattern[0] != '/')
+        {
+            return nullptr;
+        }
+        Node *n = insert(m_root, pattern, 0);
+        if (!n)
+        {
+            return nullptr;
+        }
+        n->has_value = true;
+        return &n->value;
+    }
+
+    /*查找路径[path, path + len)，找不到时返回空。params记录变量匹配到的部分*/
+    const T *match(const char *path, int len, RouteParams &params) const
+    {
+        params.count = 0;
+        const Node *n = match(m_root, path, path, path + len, params);
+        return n ? &n->value : nullptr;
+    }
+
+private:
+    struct Node
+    {
+        Node() : param(nullptr), wildcard(nullptr), has_value(false), value() {}
+
+        std::string label;           //静态边上的字符串（压缩了只有一个子节点的路径）
+        std::vector<Node *> children; //静态子节点，首字符互不相同
+        Node *param;                 //":name"子节点
+        Node *wildcard;              //"*name"子节点，总是叶子
+        std::string name;            //本节点是变量节点时的变量名
+        bool has_value;
+        T value;
+    };
+
+    static void destroy(Node *n)
+    {
+        for (size_t i = 0; i < n->children.size(); i++)
+        {
+            destroy(n->children[i]);
+        }
+        if (n->param)
+        {
+            destroy(n->param);
+        }
+        if (n->wildcard)
+        {
+            destroy(n->wildcard);
+        }
+        delete n;
+    }
+
+    //在n之后插入模式的剩余部分p，depth是已经经过的变量个数，返回模式结束处的节点
+    static Node *insert(Node *n, const char *p, int depth)
+    {
+        if (*p == '\0')
+        {
+            return n;
+        }
+        if (*p == ':' || *p == '*')
+        {
+            bool wild = *p == '*';
+            int len = wild ? strlen(p + 1) : strcspn(p + 1, "/");
+            if ((len == 0 && !wild) || depth >= RouteParams::MAX_PARAMS || (wild && strchr(p + 1, '/')))
+            {
+                return nullptr;
+            }
+            Node *&child = wild ? n->wildcard : n->param;
+            if (!child)
+            {
+                child = new Node;
+                child->name.assign(p + 1, len);
+            }
+            else if (child->name.compare(0, std::string::npos, p + 1, len) != 0)
+            {
+                return nullptr;
+            }
+            return insert(child, p + 1 + len, depth + 1);
+        }
+        //静态部分：与首字符相同的子节点共享公共前缀，前缀只覆盖子节点的一部分时把子节点分裂成两段
+        int len = strcspn(p, ":*");
+        for (size_t i = 0; i < n->children.size(); i++)
+        {
+            Node *c = n->children[i];
+            if (c->label[0] != p[0])
+            {
+                continue;
+            }
+            int common = 0;
+            while (common < len && common < (int)c->label.size() && c->label[common] == p[common])
+            {
+                common++;
+            }
+            if (common < (int)c->label.size())
+            {
+                Node *mid = new Node;
+                mid->label = c->label.substr(0, common);
+                c->label.erase(0, common);
+                mid->children.push_back(c);
+                n->children[i] = mid;
+                c = mid;
+            }
+            return insert(c, p + common, depth);
+        }
+        Node *c = new Node;
+        c->label.assign(p, len);
+        n->children.push_back(c);
+        return insert(c, p + len, depth);
+    }
+
+    //从n开始匹配路径的剩余部分[p, end)，失败时回溯，依次尝试静态子节点、":name"和"*name"
+    static const Node *match(const Node *n, const char *base, const char *p, const char *end, RouteParams &params)
+    {
+        if (p == end && n->has_value)
+        {
+            return n;
+        }
+        if (p < end)
+        {
+            for (size_t i = 0; i < n->children.size(); i++)
+            {
+                const Node *c = n->children[i];
+                int len = c->label.size();
+                if (c->label[0] == *p && end - p >= len && memcmp(c->label.data(), p, len) == 0)
+                {
+                    const Node *r = match(c, base, p + len, end, params);
+                    if (r)
+                    {
+                        return r;
+                    }
+                    //首字符互不相同，其他静态子节点不可能匹配
+                    break;
+                }
+            }
+            if (n->param)
+            {
+                const char *seg = (const char *)memchr(p, '/', end - p);
+                int len = (seg ? seg : end) - p;
+                if (len > 0)
+                {
+                    int saved = params.count;
+                    params.items[params.count++] = {n->param->name.c_str(), (int)(p - base), len};
+                    const Node *r = match(n->param, base, p + len, end, params);
+                    if (r)
+                    {
+                        return r;
+                    }
+                    params.count = saved;
+                }
+            }
+        }
+        if (n->wildcard && n->wildcard->has_value)
+        {
+            params.items[params.count++] = {n->wildcard->name.c_str(), (int)(p - base), (int)(end - p)};
+            return n->wildcard;
+        }
+        return nullptr;
+    }
+
+private:
+    Node *m_root;
+};
+
+#endif
@@ -0,0 +1,301 @@
+/**
+  * @file    :stats.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :stats.h的源文件
+  */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "stats.h"
+
+const int Stats::STATUS_CODES[STATUS_NUM] = {200, 201, 206, 304, 400, 403, 404, 413, 416, 429, 500, 503, 0};
+std::atomic<Stats::ThreadStats *> Stats::m_threads[MAX_THREADS];
+std::atomic<int> Stats::m_thread_count(0);
+std::vector<Stats::Metric> Stats::m_metrics;
+
+static const char *stage_names[Stats::STAGE_NUM] = {"loop", "read", "queue", "parse", "do_request", "write"};
+static const char *counter_names[Stats::COUNTER_NUM] = {"connections_accepted_total", "requests_total",
+                                                        "received_bytes_total", "sent_bytes_total",
+                                                        "write_eagain_total", "epoll_wait_calls_total",
+                                                        "epoll_ctl_calls_total", "read_calls_total",
+                                                        "write_calls_total", "connections_limited_total",
+                                                        "connections_saturated_total"};
+static const char *counter_helps[Stats::COUNTER_NUM] = {"Accepted connections.", "Parsed requests.",
+                                                        "Bytes received from clients.", "Bytes sent to clients.",
+                                                        "Writes that found the socket buffer full.",
+                                                        "epoll_wait system calls.", "epoll_ctl system calls.",
+                                                        "readv system calls on client sockets.",
+                                                        "sendmsg and sendfile system calls on client sockets.",
+                                                        "Connections answered with 429 at accept by the per-address limits.",
+                                                        "Of those, connections refused because the limit table had no free entry for the address."};
+/*Prometheus直方图的桶边界（秒），由细粒度的桶累加得到*/
+static const double prom_bounds[] = {1e-6, 2e-6, 5e-6, 1e-5, 2e-5, 5e-5, 1e-4, 2e-4, 5e-4,
+                                     1e-3, 2e-3, 5e-3, 1e-2, 2e-2, 5e-2, 0.1, 0.2, 0.5, 1, 5};
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+Stats::ThreadStats *Stats::local()
+{
+    static thread_local ThreadStats *stats = nullptr;
+    static thread_local bool full = false;
+    if (!stats && !full)
+    {
+        int idx = m_thread_count.fetch_add(1);
+        if (idx >= MAX_THREADS)
+        {
+            full = true;
+            return nullptr;
+        }
+        //线程不会退出，统计数据也不释放；value-initialize把所有计数清零
+        stats = new ThreadStats();
+        m_threads[idx].store(stats, std::memory_order_release);
+    }
+    return stats;
+}
+
+int Stats::bucket(uint64_t v)
+{
+    if (v < (uint64_t)SUB_COUNT)
+    {
+        return v;
+    }
+    int exp = 63 - __builtin_clzll(v);
+    if (exp > MAX_EXP)
+    {
+        return BUCKETS - 1;
+    }
+    int sub = (v >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+    return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t Stats::bucket_upper(int idx)
+{
+    if (idx < SUB_COUNT)
+    {
+        return idx;
+    }
+    int exp = idx / SUB_COUNT + SUB_BITS - 1;
+    uint64_t sub = idx % SUB_COUNT;
+    return ((SUB_COUNT + sub + 1) << (exp - SUB_BITS)) - 1;
+}
+
+void Stats::record(STAGE stage, long ns)
+{
+    ThreadStats *s = local();
+    if (!s)
+    {
+        return;
+    }
+    uint64_t v = ns > 0 ? ns : 0;
+    inc(s->hist[stage][bucket(v)], 1);
+    inc(s->sum[stage], v);
+    if (v > s->max[stage].load(std::memory_order_relaxed))
+    {
+        s->max[stage].store(v, std::memory_order_relaxed);
+    }
+}
+
+void Stats::add(COUNTER counter, long n)
+{
+    ThreadStats *s = local();
+    if (s)
+    {
+        inc(s->counters[counter], n);
+    }
+}
+
+void Stats::status(int code)
+{
+    ThreadStats *s = local();
+    if (!s)
+    {
+        return;
+    }
+    int i = 0;
+    while (i < STATUS_NUM - 1 && STATUS_CODES[i] != code)
+    {
+        i++;
+    }
+    inc(s->status[i], 1);
+}
+
+void Stats::add_metric(const char *name, const char *help, const char *type, std::function<long()> fn)
+{
+    m_metrics.push_back(Metric{name, help, type, fn});
+}
+
+void Stats::snapshot(Snapshot &s)
+{
+    memset(&s, 0, sizeof(s));
+    int n = m_thread_count.load(std::memory_order_acquire);
+    if (n > MAX_THREADS)
+    {
+        n = MAX_THREADS;
+    }
+    for (int t = 0; t < n; t++)
+    {
+        //登记的序号已经分配、指针还没有写入的线程跳过
+        ThreadStats *ts = m_threads[t].load(std::memory_order_acquire);
+        if (!ts)
+        {
+            continue;
+        }
+        for (int i = 0; i < STAGE_NUM; i++)
+        {
+            for (int b = 0; b < BUCKETS; b++)
+            {
+                uint64_t c = ts->hist[i][b].load(std::memory_order_relaxed);
+                s.hist[i][b] += c;
+                s.count[i] += c;
+            }
+            s.sum[i] += ts->sum[i].load(std::memory_order_relaxed);
+            uint64_t m = ts->max[i].load(std::memory_order_relaxed);
+            if (m > s.max[i])
+            {
+                s.max[i] = m;
+            }
+        }
+        for (int i = 0; i < COUNTER_NUM; i++)
+        {
+            s.counters[i] += ts->counters[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < STATUS_NUM; i++)
+        {
+            s.status[i] += ts->status[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t Stats::percentile(const Snapshot &s, int stage, double q)
+{
+    if (s.count[stage] == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * s.count[stage]);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        seen += s.hist[stage][b];
+        if (seen > rank)
+        {
+            uint64_t upper = bucket_upper(b);
+            return upper < s.max[stage] ? upper : s.max[stage];
+        }
+    }
+    return s.max[stage];
+}
+
+/*向字符串追加格式化的文本*/
+static void appendf(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string &out, const char *format, ...)
+{
+    char buf[256];
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if (n > 0)
+    {
+        out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+}
+
+void Stats::render_prometheus(std::string &out)
+{
+    //快照有几十KB，放在堆上
+    Snapshot *s = new Snapshot;
+    snapshot(*s);
+    for (int i = 0; i < COUNTER_NUM; i++)
+    {
+        appendf(out, "# HELP webserver_%s %s\n# TYPE webserver_%s counter\nwebserver_%s %lu\n",
+                counter_names[i], counter_helps[i], counter_names[i], counter_names[i], s->counters[i]);
+    }
+    out += "# HELP webserver_responses_total Responses by status code.\n# TYPE webserver_responses_total counter\n";
+    for (int i = 0; i < STATUS_NUM; i++)
+    {
+        if (STATUS_CODES[i])
+        {
+            appendf(out, "webserver_responses_total{code=\"%d\"} %lu\n", STATUS_CODES[i], s->status[i]);
+        }
+        else
+        {
+            appendf(out, "webserver_responses_total{code=\"other\"} %lu\n", s->status[i]);
+        }
+    }
+    for (size_t i = 0; i < m_metrics.size(); i++)
+    {
+        const Metric &m = m_metrics[i];
+        appendf(out, "# HELP webserver_%s %s\n# TYPE webserver_%s %s\nwebserver_%s %ld\n",
+                m.name, m.help, m.name, m.type, m.name, m.fn());
+    }
+
+    out += "# HELP webserver_stage_seconds Latency of each processing stage.\n# TYPE webserver_stage_seconds histogram\n";
+    for (int i = 0; i < STAGE_NUM; i++)
+    {
+        int b = 0;
+        uint64_t cumulative = 0;
+        for (size_t k = 0; k < sizeof(prom_bounds) / sizeof(prom_bounds[0]); k++)
+        {
+            uint64_t bound = prom_bounds[k] * 1e9;
+            while (b < BUCKETS && bucket_upper(b) <= bound)
+            {
+                cumulative += s->hist[i][b++];
+            }
+            appendf(out, "webserver_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %lu\n", stage_names[i], prom_bounds[k], cumulative);
+        }
+        appendf(out, "webserver_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", stage_names[i], s->count[i]);
+        appendf(out, "webserver_stage_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[i], s->sum[i] / 1e9);
+        appendf(out, "webserver_stage_seconds_count{stage=\"%s\"} %lu\n", stage_names[i], s->count[i]);
+    }
+    //直方图的桶太粗时看不出尾部延迟，另外给出由细粒度的桶算出的分位数
+    out += "# HELP webserver_stage_quantile_seconds Latency quantiles of each processing stage.\n# TYPE webserver_stage_quantile_seconds gauge\n";
+    for (int i = 0; i < STAGE_NUM; i++)
+    {
+        for (size_t k = 0; k < sizeof(quantiles) / sizeof(quantiles[0]); k++)
+        {
+            appendf(out, "webserver_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                    stage_names[i], quantiles[k], percentile(*s, i, quantiles[k]) / 1e9);
+        }
+    }
+    delete s;
+}
+
+void Stats::render_json(std::string &out)
+{
+    Snapshot *s = new Snapshot;
+    snapshot(*s);
+    out += "{\"counters\":{";
+    for (int i = 0; i < COUNTER_NUM; i++)
+    {
+        appendf(out, "%s\"%s\":%lu", i ? "," : "", counter_names[i], s->counters[i]);
+    }
+    for (size_t i = 0; i < m_metrics.size(); i++)
+    {
+        appendf(out, ",\"%s\":%ld", m_metrics[i].name, m_metrics[i].fn());
+    }
+    out += "},\"responses\":{";
+    for (int i = 0; i < STATUS_NUM; i++)
+    {
+        if (STATUS_CODES[i])
+        {
+            appendf(out, "%s\"%d\":%lu", i ? "," : "", STATUS_CODES[i], s->status[i]);
+        }
+        else
+        {
+            appendf(out, ",\"other\":%lu", s->status[i]);
+        }
+    }
+    out += "},\"stages\":{";
+    for (int i = 0; i < STAGE_NUM; i++)
+    {
+        double mean = s->count[i] ? (double)s->sum[i] / s->count[i] / 1e3 : 0;
+        appendf(out, "%s\"%s\":{\"count\":%lu,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f}",
+                i ? "," : "", stage_names[i], s->count[i], mean,
+                percentile(*s, i, 0.5) / 1e3, percentile(*s, i, 0.9) / 1e3, percentile(*s, i, 0.99) / 1e3,
+                percentile(*s, i, 0.999) / 1e3, s->max[i] / 1e3);
+    }
+    out += "}}\n";
+    delete s;
+}
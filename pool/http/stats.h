@@ -0,0 +1,144 @@
+/**
+  * @file    :stats.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :运行时统计：各处理阶段的延迟直方图，字节数、请求数、状态码、EAGAIN等计数器，以及队列长度等指标。
+  * 每个线程写自己的一份统计数据（只有一个写者，不需要原子的读-改-写），读取时把所有线程的数据相加，全程不加锁。
+  * 统计结果由保留的URL /_server/stats 以Prometheus文本格式（/_server/stats?format=json 为JSON格式）输出
+*/
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <time.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+class Stats
+{
+public:
+    /*处理阶段，每个阶段一个延迟直方图*/
+    enum STAGE
+    {
+        STAGE_LOOP = 0,   //事件循环处理一轮就绪事件（epoll_wait或io_uring_enter返回之后）
+        STAGE_READ,       //HTTPConn::Read
+        STAGE_QUEUE,      //在线程池请求队列中的排队时间
+        STAGE_PARSE,      //解析出一个完整请求的process_read，包含do_request
+        STAGE_DO_REQUEST, //do_request：查找文件缓存、判断条件请求
+        STAGE_WRITE,      //HTTPConn::Write
+        STAGE_NUM
+    };
+    /*计数器*/
+    enum COUNTER
+    {
+        ACCEPTED = 0, //接受的连接数
+        REQUESTS,     //处理的请求数
+        BYTES_IN,     //收到的字节数
+        BYTES_OUT,    //发出的字节数
+        WRITE_EAGAIN, //发送时socket写缓冲区已满、等待可写的次数
+        SYS_EPOLL_WAIT, //epoll后端的系统调用次数，除以请求数得到每个请求的系统调用数
+        SYS_EPOLL_CTL,
+        SYS_READ,       //readv
+        SYS_WRITE,      //sendmsg和sendfile
+        CONN_LIMITED,   //超过按地址的限制、accept之后直接回复429关闭的连接数
+        CONN_SATURATED, //其中因为限制表的桶已满、无法记录对方地址而拒绝的连接数
+        COUNTER_NUM
+    };
+
+    //记录一次耗时ns纳秒的阶段
+    static void record(STAGE stage, long ns);
+    static void add(COUNTER counter, long n = 1);
+    //记录一个响应的状态码
+    static void status(int code);
+    //单调时钟的当前时间（纳秒），用于计算各阶段的耗时
+    static long now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000L + ts.tv_nsec;
+    }
+
+    /*注册一个由其他模块维护的指标（队列长度、连接数、文件缓存等），输出统计结果时调用fn取值。
+    type是Prometheus的指标类型："counter"或"gauge"。只在启动时、事件循环运行之前调用*/
+    static void add_metric(const char *name, const char *help, const char *type, std::function<long()> fn);
+
+    //输出所有线程统计数据的汇总
+    static void render_prometheus(std::string &out);
+    static void render_json(std::string &out);
+
+private:
+    /*HDR风格的对数-线性分桶：小于16的值每个值一个桶；之后每个2的幂区间再等分成16个桶，相对误差不超过1/16。
+    最大记录到2^40纳秒（约18分钟），更大的值计入最后一个桶*/
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_EXP = 40;
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+    /*最多统计的线程数，超过的线程不记录*/
+    static const int MAX_THREADS = 256;
+    /*响应状态码，不在表中的计入最后一项*/
+    static const int STATUS_NUM = 13;
+    static const int STATUS_CODES[STATUS_NUM];
+
+    /*一个线程的统计数据。只有所属线程写入，用relaxed的load+store代替fetch_add，读者用relaxed load*/
+    struct ThreadStats
+    {
+        std::atomic<uint64_t> hist[STAGE_NUM][BUCKETS];
+        std::atomic<uint64_t> sum[STAGE_NUM];
+        std::atomic<uint64_t> max[STAGE_NUM];
+        std::atomic<uint64_t> counters[COUNTER_NUM];
+        std::atomic<uint64_t> status[STATUS_NUM];
+    };
+    /*所有线程汇总之后的数据*/
+    struct Snapshot
+    {
+        uint64_t hist[STAGE_NUM][BUCKETS];
+        uint64_t count[STAGE_NUM];
+        uint64_t sum[STAGE_NUM];
+        uint64_t max[STAGE_NUM];
+        uint64_t counters[COUNTER_NUM];
+        uint64_t status[STATUS_NUM];
+    };
+    /*其他模块注册的指标*/
+    struct Metric
+    {
+        const char *name;
+        const char *help;
+        const char *type;
+        std::function<long()> fn;
+    };
+
+    //当前线程的统计数据，第一次使用时分配并登记，线程数超过上限时返回空
+    static ThreadStats *local();
+    static int bucket(uint64_t v);
+    //桶中的值的上界
+    static uint64_t bucket_upper(int idx);
+    static void snapshot(Snapshot &s);
+    //直方图的第q分位数（纳秒）
+    static uint64_t percentile(const Snapshot &s, int stage, double q);
+    static void inc(std::atomic<uint64_t> &v, uint64_t n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+private:
+    static std::atomic<ThreadStats *> m_threads[MAX_THREADS];
+    static std::atomic<int> m_thread_count;
+    static std::vector<Metric> m_metrics;
+};
+
+/*在作用域结束时记录一个阶段的耗时，用于有多个返回点的函数*/
+class StageTimer
+{
+public:
+    explicit StageTimer(Stats::STAGE stage) : m_stage(stage), m_start(Stats::now()) {}
+    ~StageTimer() { Stats::record(m_stage, Stats::now() - m_start); }
+
+private:
+    Stats::STAGE m_stage;
+    long m_start;
+};
+
+#endif
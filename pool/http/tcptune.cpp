@@ -0,0 +1,145 @@
+/**
+  * @file    :tcptune.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :tcptune.h的源文件
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "tcptune.h"
+
+/*每个调优参数对应的socket选项。inherited为true的选项只在监听socket上设置一次：它们被新连接继承，
+或者（TCP_DEFER_ACCEPT、TCP_FASTOPEN）本来就只作用于监听socket；为false的选项对每个新连接设置*/
+struct TcpOption
+{
+    const char *name;
+    int level;
+    int optname;
+    int TcpProfile::*field;
+    bool inherited;
+};
+
+static const TcpOption tcp_options[] = {
+    {"nodelay", IPPROTO_TCP, TCP_NODELAY, &TcpProfile::nodelay, true},
+    {"defer-accept", IPPROTO_TCP, TCP_DEFER_ACCEPT, &TcpProfile::defer_accept, true},
+    {"fastopen", IPPROTO_TCP, TCP_FASTOPEN, &TcpProfile::fastopen, true},
+    {"rcvbuf", SOL_SOCKET, SO_RCVBUF, &TcpProfile::rcvbuf, true},
+    {"sndbuf", SOL_SOCKET, SO_SNDBUF, &TcpProfile::sndbuf, true},
+    {"notsent-lowat", IPPROTO_TCP, TCP_NOTSENT_LOWAT, &TcpProfile::notsent_lowat, true},
+    {"busy-poll", SOL_SOCKET, SO_BUSY_POLL, &TcpProfile::busy_poll, true},
+    {"quickack", IPPROTO_TCP, TCP_QUICKACK, &TcpProfile::quickack, false},
+};
+static const int TCP_OPTION_NUM = sizeof(tcp_options) / sizeof(tcp_options[0]);
+
+/*预设。latency（默认）：小响应立即发出，握手完成但还没有发来请求的连接留在内核中，不唤醒事件循环、不占用连接对象；
+throughput在latency的基础上设置TCP_NOTSENT_LOWAT，sendfile发送大文件时未发送的数据降到128KB以下才重新写，
+每次写的数据更多，唤醒次数更少。缓冲区大小、busy poll和quickack在回环测试中没有可测量的收益，不放进预设*/
+static void set_preset(const char *name, TcpProfile &profile, bool &ok)
+{
+    ok = true;
+    if (strcmp(name, "none") == 0)
+    {
+        profile = TcpProfile();
+    }
+    else if (strcmp(name, "latency") == 0)
+    {
+        profile = TcpProfile();
+        profile.nodelay = 1;
+        profile.defer_accept = 1;
+    }
+    else if (strcmp(name, "throughput") == 0)
+    {
+        set_preset("latency", profile, ok);
+        profile.notsent_lowat = 128 * 1024;
+    }
+    else
+    {
+        ok = false;
+    }
+}
+
+bool parse_tcp_profile(const char *spec, TcpProfile &profile)
+{
+    char buf[256];
+    if (strlen(spec) >= sizeof(buf))
+    {
+        return false;
+    }
+    strcpy(buf, spec);
+    char *save = NULL;
+    for (char *item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(item, '=');
+        if (!eq)
+        {
+            bool ok;
+            set_preset(item, profile, ok);
+            if (!ok)
+            {
+                return false;
+            }
+            continue;
+        }
+        *eq = '\0';
+        char *end;
+        errno = 0;
+        long value = strtol(eq + 1, &end, 10);
+        if (eq[1] == '\0' || *end != '\0' || errno != 0 || value < 0 || value > 0x7fffffff)
+        {
+            return false;
+        }
+        int i = 0;
+        while (i < TCP_OPTION_NUM && strcmp(item, tcp_options[i].name) != 0)
+        {
+            i++;
+        }
+        if (i == TCP_OPTION_NUM)
+        {
+            return false;
+        }
+        profile.*tcp_options[i].field = (int)value;
+    }
+    return true;
+}
+
+bool apply_listener_options(int lfd, const TcpProfile &profile)
+{
+    /*监听socket总是设置SO_REUSEADDR：重启服务器时端口上还有TIME_WAIT状态的旧连接，不设置的话bind会失败*/
+    int reuse = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    for (int i = 0; i < TCP_OPTION_NUM; i++)
+    {
+        const TcpOption &opt = tcp_options[i];
+        int value = profile.*opt.field;
+        if (!opt.inherited || value < 0)
+        {
+            continue;
+        }
+        if (setsockopt(lfd, opt.level, opt.optname, &value, sizeof(value)) == -1)
+        {
+            printf("set tcp option %s=%d failure: %s\n", opt.name, value, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+void apply_accepted_options(int fd, const TcpProfile &profile)
+{
+    for (int i = 0; i < TCP_OPTION_NUM; i++)
+    {
+        const TcpOption &opt = tcp_options[i];
+        int value = profile.*opt.field;
+        if (!opt.inherited && value >= 0)
+        {
+            setsockopt(fd, opt.level, opt.optname, &value, sizeof(value));
+        }
+    }
+}
@@ -0,0 +1,42 @@
+/**
+  * @file    :tcptune.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :监听socket的TCP调优参数：TCP_NODELAY、TCP_DEFER_ACCEPT、TCP_FASTOPEN、SO_RCVBUF/SO_SNDBUF、
+  * TCP_NOTSENT_LOWAT、SO_BUSY_POLL和TCP_QUICKACK。
+  * 选项在bind之前对监听socket设置一次，accept得到的socket从监听socket复制这些设置；
+  * 只有TCP_QUICKACK不会被继承（它只影响连接当前的ACK模式），需要对每个新连接单独设置
+*/
+
+#ifndef __TCPTUNE_H
+#define __TCPTUNE_H
+
+/*一组TCP调优参数，取值-1表示不设置、保持内核的默认值*/
+struct TcpProfile
+{
+    int nodelay;       //TCP_NODELAY，0或1
+    int defer_accept;  //TCP_DEFER_ACCEPT：连接建立后等待第一个数据的秒数，期间不唤醒accept
+    int fastopen;      //TCP_FASTOPEN：等待accept的TFO请求的队列长度
+    int rcvbuf;        //SO_RCVBUF（字节），设置后该方向的缓冲区不再自动调整
+    int sndbuf;        //SO_SNDBUF（字节）
+    int notsent_lowat; //TCP_NOTSENT_LOWAT：写缓冲区中未发送的数据低于该值（字节）时才报告可写
+    int busy_poll;     //SO_BUSY_POLL：读空socket时忙等新数据的微秒数
+    int quickack;      //TCP_QUICKACK，0或1，对每个新连接设置
+
+    TcpProfile()
+        : nodelay(-1), defer_accept(-1), fastopen(-1), rcvbuf(-1), sndbuf(-1),
+          notsent_lowat(-1), busy_poll(-1), quickack(-1) {}
+};
+
+/*解析调优参数：逗号分隔，每项是预设名或者name=value，后面的项覆盖前面的设置。
+预设有none（全部保持内核默认）、latency和throughput；name是上面各选项去掉前缀的小写名字，
+下划线写成'-'，如"latency,rcvbuf=262144,busy-poll=0"。格式错误时返回false*/
+bool parse_tcp_profile(const char *spec, TcpProfile &profile);
+
+//在bind/listen之前设置监听socket的选项，失败时打印出错的选项并返回false
+bool apply_listener_options(int lfd, const TcpProfile &profile);
+
+//设置accept得到的socket上不能从监听socket继承的选项，没有需要设置的选项时不做系统调用
+void apply_accepted_options(int fd, const TcpProfile &profile);
+
+#endif
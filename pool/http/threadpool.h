@@ -3,43 +3,79 @@
 
 #include <list>
 #include <cstdio>
+#include <ctime>
+#include <atomic>
 #include <exception>
 #include <pthread.h>
 #include "locker.h"
+#include "stats.h"
+#include "trace.h"
 
-//线程池类，定义为模板类，模板参数T是任务类
+/*线程池类，定义为模板类，模板参数T是任务类，需要提供process()和shed()：
+请求在队列中等待太久（过载）时不再处理，改为调用shed()快速拒绝*/
 template <typename T>
 class threadpool
 {
 
 public:
-    /*参数thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    /*参数thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量。
+    target_ms和interval_ms控制按排队时间的丢弃（CoDel）：最近interval_ms内请求的最短排队时间都超过target_ms时
+    判定为过载，排队超过target_ms的请求被丢弃；不过载时只丢弃排队超过interval_ms的请求。target_ms为0时不按排队时间丢弃*/
+    threadpool(int thread_number = 8, int max_requests = 10000, int target_ms = 5, int interval_ms = 100);
     ~threadpool();
-    /*往请求队列中添加任务*/
+    /*往请求队列中添加任务，队列已满时返回false，由调用者拒绝请求*/
     bool append(T *request);
+    /*因为队列已满被拒绝的请求数和因为排队太久被丢弃的请求数*/
+    long rejected() const { return m_rejected.load(std::memory_order_relaxed); }
+    long shed() const { return m_shed.load(std::memory_order_relaxed); }
+    /*请求队列当前的长度*/
+    int size() const { return m_queue_len.load(std::memory_order_relaxed); }
 
 private:
+    /*请求队列中的任务，记录入队的时间*/
+    struct task
+    {
+        T *request;
+        long enqueue_us;
+    };
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之*/
     static void *worker(void *arg);
     void run();
+    //出队时根据排队时间判断是否丢弃任务，持有队列锁时调用
+    bool should_shed(long sojourn_us, long now_us);
+    static long now_us()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+    }
 
 private:
-    int m_thread_number;        //线程池中的线程数量
-    int m_max_requests;         //请求队列中允许的最大请求数
-    pthread_t *m_threads;       //线程池
-    std::list<T *> m_workqueue; //请求队列
-    locker m_queuelocker;       //请求队列的互斥锁，保护请求队列
-    sem m_queuestat;            //请求队列的信号量，判断请求队列是否有任务
-    bool m_stop;                //是否结束线程
+    int m_thread_number;          //线程池中的线程数量
+    int m_max_requests;           //请求队列中允许的最大请求数
+    pthread_t *m_threads;         //线程池
+    std::list<task> m_workqueue;  //请求队列
+    locker m_queuelocker;         //请求队列的互斥锁，保护请求队列
+    sem m_queuestat;              //请求队列的信号量，判断请求队列是否有任务
+    bool m_stop;                  //是否结束线程
+    long m_target_us;             //过载时允许的排队时间
+    long m_interval_us;           //观察最短排队时间的窗口，也是不过载时允许的排队时间
+    long m_window_end;            //当前观察窗口的结束时间
+    long m_window_min;            //当前观察窗口内的最短排队时间
+    bool m_overloaded;            //上一个观察窗口是否过载
+    std::atomic<long> m_rejected; //队列已满被拒绝的请求数
+    std::atomic<long> m_shed;     //排队太久被丢弃的请求数
+    std::atomic<int> m_queue_len; //请求队列的长度，统计用，不加锁读取
 };
 
 //定义构造函数：创建线程池，并分离线程
 template <typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests)
-    : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(nullptr)
+threadpool<T>::threadpool(int thread_number, int max_requests, int target_ms, int interval_ms)
+    : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(nullptr),
+      m_target_us(target_ms * 1000L), m_interval_us(interval_ms * 1000L), m_window_end(0), m_window_min(-1),
+      m_overloaded(false), m_rejected(0), m_shed(0), m_queue_len(0)
 {
-    if ((thread_number <= 0) || (max_requests < 0))
+    if ((thread_number <= 0) || (max_requests < 0) || (target_ms < 0) || (interval_ms < target_ms))
     {
         throw std::exception();
     }
@@ -52,7 +88,7 @@ threadpool<T>::threadpool(int thread_number, int max_requests)
     //创建线程,并将它们都线程分离：之后不需要回收线程
     for (size_t i = 0; i < m_thread_number; i++)
     {
-        printf("create the NO.%d thread\n", i+1);
+        TRACE(TRACE_INFO, Trace::THREAD_START, -1, i + 1, nullptr);
         //创建线程
         if (pthread_create(m_threads + i, NULL, worker, this) != 0)
         {
@@ -83,14 +119,16 @@ bool threadpool<T>::append(T *request)
     //加锁
     m_queuelocker.lock();
     //判断请求队列的任务数量
-    if (m_workqueue.size() > m_max_requests)
+    if (m_workqueue.size() >= m_max_requests)
     {
         //解锁
         m_queuelocker.unlock();
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
     //添加任务
-    m_workqueue.push_back(request);
+    m_workqueue.push_back(task{request, now_us()});
+    m_queue_len.store(m_workqueue.size(), std::memory_order_relaxed);
     //解锁
     m_queuelocker.unlock();
     //增加信号量
@@ -126,18 +164,57 @@ void threadpool<T>::run()
             continue;
         }
         //获得任务
-        T *request = m_workqueue.front();
+        task t = m_workqueue.front();
         //出队
         m_workqueue.pop_front();
+        m_queue_len.store(m_workqueue.size(), std::memory_order_relaxed);
+        long now = now_us();
+        Stats::record(Stats::STAGE_QUEUE, (now - t.enqueue_us) * 1000);
+        bool drop = should_shed(now - t.enqueue_us, now);
         //解锁
         m_queuelocker.unlock();
-        if (!request)
+        if (!t.request)
+        {
+            continue;
+        }
+        //排队太久的请求即使处理了，客户端多半也已经等不及了，快速拒绝，把工作线程留给新的请求
+        if (drop)
         {
+            m_shed.fetch_add(1, std::memory_order_relaxed);
+            t.request->shed();
             continue;
         }
         //处理任务
-        request->process();
+        t.request->process();
+    }
+}
+
+/*CoDel的思路：短暂的突发会让排队时间变长，但很快会排空，窗口内总有排队时间很短的请求；
+如果整个窗口内的最短排队时间都超过target，说明队列是持续积压的，这时只保留排队时间不超过target的请求，
+让被接受的请求的延迟保持有界*/
+template <typename T>
+bool threadpool<T>::should_shed(long sojourn_us, long now_us)
+{
+    if (m_target_us == 0)
+    {
+        return false;
+    }
+    if (m_window_min < 0 || sojourn_us < m_window_min)
+    {
+        m_window_min = sojourn_us;
+    }
+    //队列排空说明积压已经消除
+    if (m_workqueue.empty() && sojourn_us < m_target_us)
+    {
+        m_overloaded = false;
+    }
+    if (now_us >= m_window_end)
+    {
+        m_overloaded = m_window_min > m_target_us;
+        m_window_min = -1;
+        m_window_end = now_us + m_interval_us;
     }
+    return sojourn_us > (m_overloaded ? m_target_us : m_interval_us);
 }
 
 #endif
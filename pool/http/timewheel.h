@@ -0,0 +1,170 @@
+/**
+  * @file    :timewheel.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :时间轮，移植自clock/timeWheel/timeWheel.h。
+  * 定时器节点嵌入在被定时的对象中，添加、重新设置和删除定时器都只是O(1)的链表操作，不需要分配内存。
+  * 时间轮只由所属的事件循环线程访问，不加锁
+*/
+
+#ifndef __TIMEWHEEL_H
+#define __TIMEWHEEL_H
+
+#include <time.h>
+#include <vector>
+
+//时间轮的槽所指向的链表中的定时器
+class TimeWheelTimer
+{
+public:
+    TimeWheelTimer() : rotation(0), time_slot(-1), data(nullptr), next(nullptr), prev(nullptr) {}
+
+    //定时器是否在时间轮中
+    bool active() const { return time_slot >= 0; }
+
+public:
+    int rotation;         //定时器在时间轮中转多少圈后生效，相当于expire
+    int time_slot;        //定时器对应的槽，不在时间轮中时为-1
+    void *data;           //定时器所属的对象，由使用者设置
+    TimeWheelTimer *next; //指向链表中的后一个定时器
+    TimeWheelTimer *prev; //指向链表中的前一个定时器
+};
+
+//时间轮定时器容器：插入节点、删除节点、执行定时任务
+class TimeWheel
+{
+public:
+    /*slot_ms是槽间隔（毫秒）*/
+    explicit TimeWheel(int slot_ms = 1000) : m_slot_ms(slot_ms), m_cur_slot(0), m_slots(N, nullptr) {}
+
+    int slot_ms() const { return m_slot_ms; }
+
+    //单调时钟的当前时间（毫秒），不受系统时间调整的影响
+    static long now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+    }
+
+    //把定时器插入到timeout毫秒之后的槽中，定时器已经在时间轮中时先删除，相当于重新设置
+    void addClock(TimeWheelTimer *timer, int timeout)
+    {
+        delClock(timer);
+        //不足一个槽间隔的部分向上取整，定时器不会早于timeout - slot_ms到期
+        int ticks = (timeout + m_slot_ms - 1) / m_slot_ms;
+        if (ticks < 1)
+        {
+            ticks = 1;
+        }
+        //m_cur_slot是下一次tick处理的槽，第ticks次tick时到期
+        timer->rotation = (ticks - 1) / N;
+        timer->time_slot = (m_cur_slot + ticks - 1) % N;
+        link(timer);
+    }
+
+    //删除定时器，定时器不在时间轮中时什么也不做
+    void delClock(TimeWheelTimer *timer)
+    {
+        if (!timer->active())
+        {
+            return;
+        }
+        int ts = timer->time_slot;
+        //如果删除的定时器是头节点
+        if (timer == m_slots[ts])
+        {
+            m_slots[ts] = timer->next;
+        }
+        else
+        {
+            timer->prev->next = timer->next;
+        }
+        if (timer->next)
+        {
+            timer->next->prev = timer->prev;
+        }
+        timer->next = timer->prev = nullptr;
+        timer->time_slot = -1;
+    }
+
+    /*执行当前槽的所有到期的定时事件：到期的定时器先从时间轮中删除再调用callback，
+    callback中可以重新添加同一个定时器，或者删除同一个槽中的其他定时器*/
+    template <typename F>
+    void tick(F callback)
+    {
+        //取下当前槽的整个链表，时间轮先转动，callback中添加的定时器相对于新的当前槽计算
+        int slot = m_cur_slot;
+        TimeWheelTimer *list = m_slots[slot];
+        m_slots[slot] = nullptr;
+        for (TimeWheelTimer *t = list; t; t = t->next)
+        {
+            t->time_slot = -2;
+        }
+        m_cur_slot = (m_cur_slot + 1) % N;
+
+        while (list)
+        {
+            TimeWheelTimer *tmp = list;
+            list = tmp->next;
+            if (list)
+            {
+                list->prev = nullptr;
+            }
+            tmp->next = tmp->prev = nullptr;
+            /*callback删除了链表中尚未处理的定时器*/
+            if (tmp->time_slot != -2)
+            {
+                continue;
+            }
+            /*如果定时器的rotation值大于0，则它在这一轮不起作用，放回原来的槽*/
+            if (tmp->rotation > 0)
+            {
+                tmp->rotation--;
+                tmp->time_slot = slot;
+                link(tmp);
+            }
+            /*否则，说明定时器已经到期，于是执行定时任务*/
+            else
+            {
+                tmp->time_slot = -1;
+                callback(tmp);
+            }
+        }
+    }
+
+    //把时间轮中的每个定时器交给callback，callback中不能添加或删除定时器
+    template <typename F>
+    void for_each(F callback) const
+    {
+        for (int i = 0; i < N; i++)
+        {
+            for (TimeWheelTimer *t = m_slots[i]; t; t = t->next)
+            {
+                callback(t);
+            }
+        }
+    }
+
+private:
+    //头插法插入定时器所在的槽
+    void link(TimeWheelTimer *timer)
+    {
+        int ts = timer->time_slot;
+        timer->prev = nullptr;
+        timer->next = m_slots[ts];
+        if (m_slots[ts])
+        {
+            m_slots[ts]->prev = timer;
+        }
+        m_slots[ts] = timer;
+    }
+
+private:
+    static const int N = 64;              //槽的总数
+    int m_slot_ms;                        //槽间隔（毫秒）
+    int m_cur_slot;                       //当前槽
+    std::vector<TimeWheelTimer *> m_slots; //时间轮，每个元素指向一个定时器链表，链表无序
+};
+
+#endif
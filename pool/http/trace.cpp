@@ -0,0 +1,240 @@
+/**
+  * @file    :trace.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :trace.h的源文件
+  */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+static_assert(sizeof(Trace::Record) == 64, "trace record should fill one cache line");
+static_assert((Trace::RING_SIZE & (Trace::RING_SIZE - 1)) == 0, "RING_SIZE must be a power of 2");
+
+std::atomic<int> Trace::m_level(TRACE_OFF);
+std::atomic<Trace::Ring *> Trace::m_rings[MAX_THREADS];
+std::atomic<int> Trace::m_ring_count(0);
+
+static const char *level_names[] = {"off", "error", "warn", "info", "debug"};
+static const char *event_names[Trace::EVENT_NUM] = {"http_line", "unknown_header", "thread_start", "accept_error",
+                                                    "conn_rejected"};
+
+int Trace::parse_level(const char *name)
+{
+    for (int i = 0; i <= TRACE_DEBUG; i++)
+    {
+        if (strcasecmp(name, level_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    char *end;
+    long v = strtol(name, &end, 10);
+    return (*name && *end == '\0' && v >= TRACE_OFF && v <= TRACE_DEBUG) ? (int)v : -1;
+}
+
+Trace::Ring *Trace::local()
+{
+    static thread_local Ring *ring = nullptr;
+    static thread_local bool full = false;
+    if (!ring && !full)
+    {
+        int idx = m_ring_count.fetch_add(1);
+        if (idx >= MAX_THREADS)
+        {
+            full = true;
+            return nullptr;
+        }
+        //线程不会退出，环形缓冲区也不释放，导出时总能访问
+        ring = new Ring();
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tid = syscall(SYS_gettid);
+        m_rings[idx].store(ring, std::memory_order_release);
+    }
+    return ring;
+}
+
+void Trace::record(int level, int event, int fd, long arg, const char *text, int len)
+{
+    Ring *ring = local();
+    if (!ring)
+    {
+        return;
+    }
+    uint64_t h = ring->head.load(std::memory_order_relaxed);
+    Record &r = ring->records[h & (RING_SIZE - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    r.ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    r.event = event;
+    r.level = level;
+    r.fd = fd;
+    r.arg = arg;
+    if (!text)
+    {
+        len = 0;
+    }
+    else if (len < 0)
+    {
+        len = strnlen(text, sizeof(r.text));
+    }
+    else if (len > (int)sizeof(r.text))
+    {
+        len = sizeof(r.text);
+    }
+    r.len = len;
+    if (r.len > 0)
+    {
+        memcpy(r.text, text, r.len);
+    }
+    //记录写完之后才发布，导出时据此判断记录是否完整
+    ring->head.store(h + 1, std::memory_order_release);
+}
+
+/*导出时格式化一行，不使用printf（不是异步信号安全的）*/
+struct TraceLine
+{
+    char buf[192];
+    int len;
+
+    TraceLine() : len(0) {}
+    void append(const char *s, int n)
+    {
+        for (int i = 0; i < n && len < (int)sizeof(buf) - 1; i++)
+        {
+            //文本来自客户端，不可打印的字符换成'.'
+            buf[len++] = (s[i] >= 0x20 && s[i] < 0x7f) ? s[i] : '.';
+        }
+    }
+    void append(const char *s) { append(s, strlen(s)); }
+    //无符号整数，width不为0时左边补0到width位
+    void append_uint(uint64_t v, int width = 0)
+    {
+        char tmp[24];
+        int n = 0;
+        do
+        {
+            tmp[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        while (n < width)
+        {
+            tmp[n++] = '0';
+        }
+        while (n > 0 && len < (int)sizeof(buf) - 1)
+        {
+            buf[len++] = tmp[--n];
+        }
+    }
+    void append_int(int64_t v)
+    {
+        if (v < 0)
+        {
+            append("-", 1);
+            append_uint(-(uint64_t)v);
+        }
+        else
+        {
+            append_uint(v);
+        }
+    }
+};
+
+void Trace::dump(Sink sink, void *ctx)
+{
+    int count = m_ring_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count && i < MAX_THREADS; i++)
+    {
+        Ring *ring = m_rings[i].load(std::memory_order_acquire);
+        if (!ring)
+        {
+            continue;
+        }
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t start = head > (uint64_t)RING_SIZE ? head - RING_SIZE : 0;
+        for (uint64_t seq = start; seq < head; seq++)
+        {
+            Record r = ring->records[seq & (RING_SIZE - 1)];
+            /*复制之后再读一次head：写者正在写或者已经写过序号seq + RING_SIZE的记录时，复制的内容可能不完整*/
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq + RING_SIZE <= ring->head.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+            TraceLine line;
+            line.append("tid ");
+            line.append_uint(ring->tid);
+            line.append(" ");
+            line.append_uint(r.ns / 1000000000);
+            line.append(".");
+            line.append_uint(r.ns % 1000000000, 9);
+            line.append(" ");
+            line.append(r.level <= TRACE_DEBUG ? level_names[r.level] : "?");
+            line.append(" ");
+            line.append(r.event < EVENT_NUM ? event_names[r.event] : "?");
+            line.append(" fd=");
+            line.append_int(r.fd);
+            line.append(" arg=");
+            line.append_int(r.arg);
+            if (r.len > 0)
+            {
+                line.append(" ");
+                line.append(r.text, r.len < sizeof(r.text) ? r.len : sizeof(r.text));
+            }
+            line.buf[line.len++] = '\n';
+            sink(ctx, line.buf, line.len);
+        }
+    }
+}
+
+static void write_fd(void *ctx, const char *data, int len)
+{
+    int fd = *(int *)ctx;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0)
+        {
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+void Trace::crash_handler(int sig)
+{
+    if (m_ring_count.load(std::memory_order_acquire) > 0)
+    {
+        int fd = STDERR_FILENO;
+        TraceLine line;
+        line.append("---- trace dump on signal ");
+        line.append_uint(sig);
+        line.append(" ----");
+        line.buf[line.len++] = '\n';
+        write_fd(&fd, line.buf, line.len);
+        dump(write_fd, &fd);
+    }
+    //SA_RESETHAND已经恢复了默认处理方式，重新发出信号，按默认方式终止（产生core文件）
+    raise(sig);
+}
+
+void Trace::install_crash_handler()
+{
+    static const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = crash_handler;
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+    {
+        sigaction(signals[i], &sa, NULL);
+    }
+}
@@ -0,0 +1,111 @@
+/**
+  * @file    :trace.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :热点路径上的跟踪记录，代替逐行printf。每条记录是64字节的二进制结构（时间、事件、连接、一个整数参数和
+  * 最多40字节的文本），写入当前线程自己的环形缓冲区：只有一个写者，不加锁、不做系统调用，旧记录被新记录覆盖。
+  * 级别分两层：编译时TRACE_COMPILE_LEVEL以上的TRACE_*调用整个被去掉；运行时级别（--trace，默认关闭）以上的调用
+  * 只读一次全局变量、比较后返回。进程崩溃（SIGSEGV等）时记录导出到标准错误；--trace-admin时可以由本机的
+  * GET /_server/debug/trace按需导出。记录中不保存头部字段的值和查询字符串，导出的内容不含其他用户的凭据
+*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*跟踪级别，数值越大越详细*/
+#define TRACE_OFF 0
+#define TRACE_ERROR 1
+#define TRACE_WARN 2
+#define TRACE_INFO 3
+#define TRACE_DEBUG 4
+
+/*编译时保留的最详细级别，编译时加-DTRACE_COMPILE_LEVEL=0去掉所有跟踪代码*/
+#ifndef TRACE_COMPILE_LEVEL
+#define TRACE_COMPILE_LEVEL TRACE_DEBUG
+#endif
+
+/*记录一个事件：fd是相关的连接（没有时为-1），arg是事件的整数参数，text是可选的文本（只保存前40字节）。
+级别超过编译时级别时条件是常量，整个调用被编译器去掉；否则只比较运行时级别*/
+#define TRACE(lv, ev, fd, arg, text) TRACE_TEXT(lv, ev, fd, arg, text, -1)
+
+/*同TRACE，只记录text的前len个字节（len为-1时到'\0'为止）。len只在记录时求值，可以是strcspn等表达式*/
+#define TRACE_TEXT(lv, ev, fd, arg, text, len)                                     \
+    do                                                                             \
+    {                                                                              \
+        if ((lv) <= TRACE_COMPILE_LEVEL && (lv) <= Trace::level())                 \
+        {                                                                          \
+            Trace::record((lv), (ev), (fd), (arg), (text), (len));                 \
+        }                                                                          \
+    } while (0)
+
+class Trace
+{
+public:
+    /*事件类型，名字见trace.cpp*/
+    enum EVENT
+    {
+        HTTP_LINE = 0,   //解析出请求行或一个头部字段，text是方法和路径（不含查询字符串）或者字段名，不记录字段的值
+        UNKNOWN_HEADER,  //不认识的头部字段，text是字段名
+        THREAD_START,    //线程池创建工作线程，arg是序号
+        ACCEPT_ERROR,    //accept失败（队列已空之外的错误），arg是errno
+        CONN_REJECTED,   //连接数达到上限，新连接被拒绝，arg是当前连接数
+        EVENT_NUM
+    };
+
+    /*一条记录*/
+    struct Record
+    {
+        uint64_t ns;    //单调时钟（纳秒）
+        uint16_t event; //EVENT
+        uint8_t level;
+        uint8_t len;    //text的字节数
+        int32_t fd;
+        int64_t arg;
+        char text[40];
+    };
+
+    /*每个线程的环形缓冲区中的记录数，必须是2的幂*/
+    static const int RING_SIZE = 4096;
+    /*最多记录跟踪的线程数，超过的线程不记录*/
+    static const int MAX_THREADS = 256;
+
+    //当前的运行时级别
+    static int level() { return m_level.load(std::memory_order_relaxed); }
+    static void set_level(int level) { m_level.store(level, std::memory_order_relaxed); }
+    //按名字（off/error/warn/info/debug）或数字解析级别，失败时返回-1
+    static int parse_level(const char *name);
+
+    //写入一条记录，由TRACE宏调用，len为-1时text到'\0'为止
+    static void record(int level, int event, int fd, long arg, const char *text, int len);
+
+    /*导出所有线程的记录，按线程分组、每个线程内按时间顺序，每条记录一行文本，交给sink输出。
+    不分配内存、只调用异步信号安全的函数（sink也必须如此），可以在信号处理函数中调用；
+    和写者并发时，导出过程中被覆盖的记录跳过*/
+    typedef void (*Sink)(void *ctx, const char *data, int len);
+    static void dump(Sink sink, void *ctx);
+
+    //安装崩溃时的信号处理函数：SIGSEGV、SIGBUS、SIGFPE、SIGILL、SIGABRT时把记录导出到标准错误，然后按默认方式终止
+    static void install_crash_handler();
+
+private:
+    struct Ring
+    {
+        std::atomic<uint64_t> head; //下一条记录的序号，记录i在records[i % RING_SIZE]
+        int tid;
+        Record records[RING_SIZE];
+    };
+
+    //当前线程的环形缓冲区，第一次记录时创建
+    static Ring *local();
+    static void crash_handler(int sig);
+
+private:
+    static std::atomic<int> m_level;
+    static std::atomic<Ring *> m_rings[MAX_THREADS];
+    static std::atomic<int> m_ring_count;
+};
+
+#endif
@@ -0,0 +1,287 @@
+/**
+  * @file    :upgrade.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :upgrade.h的源文件
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <string>
+#include "upgrade.h"
+#include "http.h"
+#include "timewheel.h"
+
+extern char **environ;
+
+/*新进程从这个环境变量得到与旧进程相连的Unix socket*/
+static const char *UPGRADE_ENV = "WEBSERVER_UPGRADE_FD";
+/*新进程从启动到准备好服务的最长时间，超过时旧进程杀死它，继续服务*/
+static const int READY_TIMEOUT_MS = 10000;
+
+/*新进程中与旧进程相连的Unix socket，通知旧进程之后关闭*/
+static int upgrade_ctl = -1;
+
+/*升级线程的参数*/
+struct UpgradeContext
+{
+    char **argv;
+    std::vector<int> listeners;
+    std::function<void()> stop_accept;
+    int drain_ms;
+};
+
+/*SCM_RIGHTS的控制消息缓冲区，按cmsghdr对齐*/
+union FdControl
+{
+    char buf[CMSG_SPACE(sizeof(int) * MAX_UPGRADE_LISTENERS)];
+    struct cmsghdr align;
+};
+
+void block_upgrade_signal()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+int inherit_listeners(int *fds, int max)
+{
+    const char *env = getenv(UPGRADE_ENV);
+    if (!env)
+    {
+        return 0;
+    }
+    upgrade_ctl = atoi(env);
+    unsetenv(UPGRADE_ENV);
+    //新进程再次升级时，这个socket不能传给下一个新进程
+    fcntl(upgrade_ctl, F_SETFD, FD_CLOEXEC);
+
+    /*数据部分是监听socket的个数，控制消息中是它们的文件描述符，接收时直接设置FD_CLOEXEC*/
+    int count = 0;
+    FdControl control;
+    struct iovec iov = {&count, sizeof(count)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    ssize_t n;
+    do
+    {
+        n = recvmsg(upgrade_ctl, &msg, MSG_CMSG_CLOEXEC);
+    } while (n == -1 && errno == EINTR);
+    struct cmsghdr *cmsg = n == sizeof(count) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || (msg.msg_flags & MSG_CTRUNC))
+    {
+        printf("receive listening sockets from old process failure\n");
+        return -1;
+    }
+    int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *data = (int *)CMSG_DATA(cmsg);
+    if (received != count)
+    {
+        printf("receive listening sockets from old process failure\n");
+        return -1;
+    }
+    //比需要的多（新进程配置的事件循环更少）时关闭多余的，它们队列中的连接随之被内核重置
+    for (int i = max; i < received; i++)
+    {
+        close(data[i]);
+    }
+    int num = received < max ? received : max;
+    memcpy(fds, data, num * sizeof(int));
+    return num;
+}
+
+void notify_upgrade_ready()
+{
+    if (upgrade_ctl == -1)
+    {
+        return;
+    }
+    if (write(upgrade_ctl, "R", 1) != 1)
+    {
+        printf("notify old process failure\n");
+    }
+    close(upgrade_ctl);
+    upgrade_ctl = -1;
+}
+
+/*argv[0]不含'/'时按PATH查找，与shell启动时找到的是同一个文件*/
+static std::string find_executable(const char *name)
+{
+    if (strchr(name, '/'))
+    {
+        return name;
+    }
+    const char *path = getenv("PATH");
+    std::string dirs = path ? path : "/usr/local/bin:/usr/bin:/bin";
+    size_t start = 0;
+    while (start <= dirs.size())
+    {
+        size_t end = dirs.find(':', start);
+        if (end == std::string::npos)
+        {
+            end = dirs.size();
+        }
+        std::string file = (end > start ? dirs.substr(start, end - start) : ".") + "/" + name;
+        if (access(file.c_str(), X_OK) == 0)
+        {
+            return file;
+        }
+        start = end + 1;
+    }
+    return name;
+}
+
+/*启动新进程，把监听socket交给它，等待它准备好。成功返回true；新进程退出或者超时没有准备好时返回false，
+超时的新进程被杀死，它已经接受的连接随之断开*/
+static bool spawn_new_process(UpgradeContext *ctx)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        return false;
+    }
+    /*fork之后子进程中只能调用异步信号安全的函数：可执行文件的路径和环境变量在fork之前准备好*/
+    std::string path = find_executable(ctx->argv[0]);
+    char var[64];
+    snprintf(var, sizeof(var), "%s=%d", UPGRADE_ENV, sv[1]);
+    std::vector<char *> envp;
+    int env_len = strlen(UPGRADE_ENV);
+    for (char **e = environ; *e; e++)
+    {
+        if (strncmp(*e, UPGRADE_ENV, env_len) != 0 || (*e)[env_len] != '=')
+        {
+            envp.push_back(*e);
+        }
+    }
+    envp.push_back(var);
+    envp.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        //只有交给新进程的一端去掉FD_CLOEXEC。信号屏蔽字被exec保留，新进程的SIGUSR2同样由升级线程接收
+        fcntl(sv[1], F_SETFD, 0);
+        execve(path.c_str(), ctx->argv, envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    if (pid == -1)
+    {
+        close(sv[0]);
+        return false;
+    }
+
+    int count = ctx->listeners.size();
+    FdControl control;
+    struct iovec iov = {&count, sizeof(count)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), ctx->listeners.data(), sizeof(int) * count);
+    bool ready = sendmsg(sv[0], &msg, MSG_NOSIGNAL) == sizeof(count);
+
+    /*等待新进程的通知：收到一个字节表示准备好了，EOF表示新进程在准备好之前退出了*/
+    if (ready)
+    {
+        struct pollfd pfd = {sv[0], POLLIN, 0};
+        int ret;
+        do
+        {
+            ret = poll(&pfd, 1, READY_TIMEOUT_MS);
+        } while (ret == -1 && errno == EINTR);
+        char c = 0;
+        ready = ret == 1 && read(sv[0], &c, 1) == 1 && c == 'R';
+        if (ret == 0)
+        {
+            printf("new process is not ready in %d ms, kill it\n", READY_TIMEOUT_MS);
+            kill(pid, SIGKILL);
+        }
+    }
+    close(sv[0]);
+    if (!ready)
+    {
+        waitpid(pid, NULL, 0);
+    }
+    return ready;
+}
+
+static void *upgrade_worker(void *arg)
+{
+    UpgradeContext *ctx = (UpgradeContext *)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    while (1)
+    {
+        int sig;
+        if (sigwait(&set, &sig) != 0)
+        {
+            continue;
+        }
+        printf("upgrade: start %s\n", ctx->argv[0]);
+        if (spawn_new_process(ctx))
+        {
+            break;
+        }
+        //新进程没有准备好，监听socket仍然由本进程使用，可以再次发送SIGUSR2
+        printf("upgrade failure, keep serving\n");
+    }
+
+    /*新进程已经在监听socket上accept：本进程停止accept，已有的连接处理完当前请求之后关闭*/
+    printf("upgrade: new process is ready, draining %d connections\n", HTTPConn::m_user_count.load());
+    HTTPConn::set_draining();
+    ctx->stop_accept();
+    long deadline = TimeWheel::now() + ctx->drain_ms;
+    while (HTTPConn::m_user_count.load() > 0 && TimeWheel::now() < deadline)
+    {
+        usleep(20 * 1000);
+    }
+    printf("upgrade: old process exits, %d connections left\n", HTTPConn::m_user_count.load());
+    fflush(stdout);
+    /*其他线程还在运行，不执行全局对象的析构函数，直接退出*/
+    _exit(0);
+    return NULL;
+}
+
+bool start_upgrade_thread(char *argv[], const std::vector<int> &listeners, std::function<void()> stop_accept, int drain_ms)
+{
+    if ((int)listeners.size() > MAX_UPGRADE_LISTENERS)
+    {
+        return false;
+    }
+    UpgradeContext *ctx = new UpgradeContext;
+    ctx->argv = argv;
+    ctx->listeners = listeners;
+    ctx->stop_accept = stop_accept;
+    ctx->drain_ms = drain_ms;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, upgrade_worker, ctx) != 0)
+    {
+        delete ctx;
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
@@ -0,0 +1,36 @@
+/**
+  * @file    :upgrade.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :平滑升级：收到SIGUSR2时，旧进程fork并exec同一路径上的可执行文件（可能已经换成新版本），
+  * 通过一对Unix socket用SCM_RIGHTS把所有监听socket交给新进程。新进程直接在这些socket上accept，
+  * 已完成连接队列和SO_REUSEPORT分组都保持不变，升级期间不会有连接被拒绝。
+  * 新进程建立好事件循环后通知旧进程，旧进程停止accept，已有的连接处理完当前请求后关闭，
+  * 全部关闭或者超过等待时间后退出。新进程启动失败时旧进程继续服务
+*/
+
+#ifndef __UPGRADE_H
+#define __UPGRADE_H
+
+#include <vector>
+#include <functional>
+
+/*一次升级最多传递的监听socket数*/
+static const int MAX_UPGRADE_LISTENERS = 256;
+
+//在创建任何线程之前调用：屏蔽SIGUSR2，之后创建的线程都继承这个屏蔽字，信号只由升级线程用sigwait接收
+void block_upgrade_signal();
+
+/*新进程启动时调用：由旧进程启动时，从环境变量给出的Unix socket接收监听socket，存入fds（最多max个），返回个数；
+不是升级启动时返回0，出错时返回-1*/
+int inherit_listeners(int *fds, int max);
+
+//新进程的事件循环已经建立、即将开始服务时调用，通知旧进程停止accept；不是升级启动时什么也不做
+void notify_upgrade_ready();
+
+/*启动升级线程：等待SIGUSR2，收到后启动新进程并把listeners交给它，新进程准备好之后调用stop_accept
+让所有事件循环停止accept，然后等待所有连接关闭，最多等待drain_ms毫秒，之后退出进程。
+argv是本进程的命令行参数，新进程使用相同的参数。创建线程失败时返回false*/
+bool start_upgrade_thread(char *argv[], const std::vector<int> &listeners, std::function<void()> stop_accept, int drain_ms);
+
+#endif
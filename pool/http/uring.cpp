@@ -0,0 +1,225 @@
+/**
+  * @file    :uring.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :uring.h的源文件
+  */
+
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+/*内核与用户态共享的队列头尾指针，读对方写入的值用acquire，发布自己写入的值用release*/
+static inline unsigned load_acquire(const unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, unsigned v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IOUring::IOUring()
+    : m_fd(-1), m_sq_ptr(MAP_FAILED), m_sq_len(0), m_sqes((struct io_uring_sqe *)MAP_FAILED), m_sqes_len(0),
+      m_sq_entries(0), m_sqe_tail(0), m_sqe_submit(0), m_cq_ptr(MAP_FAILED), m_cq_len(0),
+      m_buf_base(NULL), m_buf_size(0), m_buf_group(0)
+{
+}
+
+IOUring::~IOUring()
+{
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+    {
+        munmap(m_cq_ptr, m_cq_len);
+    }
+    if (m_sq_ptr != MAP_FAILED)
+    {
+        munmap(m_sq_ptr, m_sq_len);
+    }
+    if (m_sqes != MAP_FAILED)
+    {
+        munmap(m_sqes, m_sqes_len);
+    }
+    if (m_fd != -1)
+    {
+        close(m_fd);
+    }
+    free(m_buf_base);
+}
+
+bool IOUring::init(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (m_fd < 0)
+    {
+        m_fd = -1;
+        return false;
+    }
+    //完成队列溢出时内核不丢弃完成事件，多射（multishot）请求依赖这一点
+    if (!(p.features & IORING_FEAT_NODROP))
+    {
+        return false;
+    }
+
+    m_sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && m_cq_len > m_sq_len)
+    {
+        m_sq_len = m_cq_len;
+    }
+    m_sq_ptr = mmap(NULL, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        return false;
+    }
+    if (single)
+    {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else
+    {
+        m_cq_ptr = mmap(NULL, m_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    m_sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(NULL, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sq_entries = p.sq_entries;
+    m_sqe_tail = m_sqe_submit = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+struct io_uring_sqe *IOUring::get_sqe()
+{
+    //提交队列已满：先提交，内核取走之后就有空位了
+    while (m_sqe_tail - load_acquire(m_sq_head) >= m_sq_entries)
+    {
+        if (submit_and_wait(0) < 0 && errno != EINTR && errno != EBUSY)
+        {
+            return NULL;
+        }
+    }
+    unsigned idx = m_sqe_tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[idx] = idx;
+    m_sqe_tail++;
+    return sqe;
+}
+
+int IOUring::submit_and_wait(unsigned wait_nr)
+{
+    //归还的缓冲区和其他请求一起提交
+    if (!m_buf_recycled.empty())
+    {
+        std::vector<unsigned short> recycled;
+        recycled.swap(m_buf_recycled);
+        for (size_t i = 0; i < recycled.size(); i++)
+        {
+            provide_buffers(recycled[i], 1, true);
+        }
+    }
+    unsigned to_submit = m_sqe_tail - m_sqe_submit;
+    store_release(m_sq_tail, m_sqe_tail);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, flags, NULL, 0);
+    if (ret >= 0)
+    {
+        m_sqe_submit += ret;
+    }
+    return ret;
+}
+
+unsigned IOUring::copy_cqes(struct io_uring_cqe *cqes, unsigned max)
+{
+    unsigned head = *m_cq_head;
+    unsigned tail = load_acquire(m_cq_tail);
+    unsigned n = 0;
+    while (head != tail && n < max)
+    {
+        const struct io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+        if (cqe.user_data != INTERNAL_DATA)
+        {
+            cqes[n++] = cqe;
+        }
+        head++;
+    }
+    store_release(m_cq_head, head);
+    return n;
+}
+
+/*使用IORING_OP_PROVIDE_BUFFERS提供缓冲区。测试用的内核上，IORING_REGISTER_PBUF_RING注册的buffer ring
+注册成功但recv总是返回ENOBUFS，所以这里没有使用buffer ring*/
+bool IOUring::setup_buffers(unsigned short bgid, unsigned count, unsigned size)
+{
+    m_buf_base = (char *)malloc((unsigned long)count * size);
+    if (!m_buf_base)
+    {
+        return false;
+    }
+    m_buf_size = size;
+    m_buf_group = bgid;
+    if (!provide_buffers(0, count, false))
+    {
+        return false;
+    }
+    //同步等待一次，确认内核接受了这组缓冲区
+    struct io_uring_cqe cqe;
+    while (load_acquire(m_cq_tail) == *m_cq_head)
+    {
+        if (submit_and_wait(1) < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+    cqe = m_cqes[*m_cq_head & *m_cq_mask];
+    store_release(m_cq_head, *m_cq_head + 1);
+    return cqe.res >= 0;
+}
+
+bool IOUring::provide_buffers(unsigned short bid, unsigned count, bool quiet)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (unsigned long)buffer(bid);
+    sqe->len = m_buf_size;
+    sqe->off = bid;
+    sqe->buf_group = m_buf_group;
+    sqe->user_data = INTERNAL_DATA;
+    if (quiet)
+    {
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+/**
+  * @file    :uring.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :io_uring的简单封装，直接使用io_uring_setup/io_uring_enter/io_uring_register系统调用，不依赖liburing。
+  * 只提供事件循环用到的功能：取提交队列项、批量提交并等待、批量取出完成事件，以及一组provided buffer
+*/
+
+#ifndef __URING_H
+#define __URING_H
+
+#include <linux/io_uring.h>
+#include <vector>
+
+class IOUring
+{
+public:
+    IOUring();
+    ~IOUring();
+
+    //创建有entries个提交队列项的io_uring，内核不支持时返回false
+    bool init(unsigned entries);
+    //取得一个清零的提交队列项，提交队列已满时先把已有的项提交给内核
+    struct io_uring_sqe *get_sqe();
+    //提交队列中的空位数，链接的多个请求必须在同一次提交中
+    unsigned sq_space() const { return m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)); }
+    //提交所有新的提交队列项，并至少等待wait_nr个完成事件，返回值同io_uring_enter
+    int submit_and_wait(unsigned wait_nr);
+    //把最多max个完成事件复制到cqes中，并从完成队列中移除，返回个数
+    unsigned copy_cqes(struct io_uring_cqe *cqes, unsigned max);
+
+    /*提供一组provided buffer：count个size字节的缓冲区，组号为bgid。
+    带IOSQE_BUFFER_SELECT的recv由内核从中挑选一个缓冲区，完成事件的flags中带有缓冲区编号*/
+    bool setup_buffers(unsigned short bgid, unsigned count, unsigned size);
+    //编号为bid的缓冲区
+    char *buffer(unsigned short bid) const { return m_buf_base + (unsigned long)bid * m_buf_size; }
+    //数据处理完之后把缓冲区还给内核，随下一次提交一起发出
+    void recycle_buffer(unsigned short bid) { m_buf_recycled.push_back(bid); }
+
+private:
+    /*IOUring自己提交的请求（归还provided buffer）的user_data，完成事件不交给调用者*/
+    static const unsigned long long INTERNAL_DATA = ~0ULL;
+    //把count个从bid开始的连续缓冲区交给内核，quiet为true时成功不产生完成事件
+    bool provide_buffers(unsigned short bid, unsigned count, bool quiet);
+
+private:
+    int m_fd;
+    /*提交队列*/
+    void *m_sq_ptr;
+    unsigned long m_sq_len;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    struct io_uring_sqe *m_sqes;
+    unsigned long m_sqes_len;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail;   //已经填好、尚未提交的提交队列项的末尾
+    unsigned m_sqe_submit; //已经提交给内核的位置
+    /*完成队列，内核支持IORING_FEAT_SINGLE_MMAP时与提交队列共用一次映射*/
+    void *m_cq_ptr;
+    unsigned long m_cq_len;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+    /*provided buffer*/
+    char *m_buf_base;
+    unsigned m_buf_size;
+    unsigned short m_buf_group;
+    std::vector<unsigned short> m_buf_recycled; //等待归还给内核的缓冲区编号
+};
+
+#endif
@@ -0,0 +1,632 @@
+/**
+  * @file    :uringloop.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :uringloop.h的源文件
+  */
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include "uringloop.h"
+#include "eventloop.h"
+
+UringLoop::UringLoop(int lfd)
+    : m_listenfd(lfd), m_wakefd(-1), m_wake_value(0), m_thread(0), m_pipe_size(SPLICE_CHUNK)
+{
+    m_now = TimeWheel::now();
+    m_next_tick = m_now + m_wheel.slot_ms();
+    m_wakefd = eventfd(0, EFD_CLOEXEC);
+    if (m_wakefd == -1 || !m_ring.init(RING_ENTRIES) || !m_ring.setup_buffers(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE))
+    {
+        if (m_wakefd != -1)
+        {
+            close(m_wakefd);
+        }
+        throw std::exception();
+    }
+}
+
+UringLoop::~UringLoop()
+{
+    for (size_t i = 0; i < m_pipes.size(); i++)
+    {
+        close(m_pipes[i]);
+    }
+    close(m_wakefd);
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+    }
+}
+
+bool UringLoop::start()
+{
+    return pthread_create(&m_thread, NULL, worker, this) == 0;
+}
+
+void UringLoop::join()
+{
+    if (m_thread)
+    {
+        pthread_join(m_thread, NULL);
+    }
+}
+
+void *UringLoop::worker(void *arg)
+{
+    UringLoop *loop = (UringLoop *)arg;
+    loop->loop();
+    return loop;
+}
+
+/*取一个提交队列项，user_data记录所属的连接和请求类型，连接的未完成请求数加一*/
+struct io_uring_sqe *UringLoop::get_sqe(Channel *ch, OP op)
+{
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe)
+    {
+        return NULL;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)ch | op;
+    if (ch)
+    {
+        ch->inflight++;
+    }
+    return sqe;
+}
+
+void UringLoop::submit_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe(NULL, OP_ACCEPT);
+    if (!sqe)
+    {
+        printf("io_uring submit accept failure\n");
+        return;
+    }
+    //多射accept：提交一次，每接受一个连接产生一个完成事件
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void UringLoop::handle_accept(int res, unsigned flags)
+{
+    //多射accept被内核终止（比如出错）时重新提交，停止accept之后被取消的不再提交
+    if (!(flags & IORING_CQE_F_MORE) && m_listenfd != -1)
+    {
+        submit_accept();
+    }
+    if (res == -ECANCELED && m_listenfd == -1)
+    {
+        return;
+    }
+    if (res < 0)
+    {
+        TRACE(TRACE_WARN, Trace::ACCEPT_ERROR, m_listenfd, -res, nullptr);
+        return;
+    }
+    int cfd = res;
+    if (HTTPConn::m_user_count >= MAX_FD)
+    {
+        TRACE(TRACE_WARN, Trace::CONN_REJECTED, cfd, HTTPConn::m_user_count.load(), nullptr);
+        close(cfd);
+        return;
+    }
+    //多射accept不能为每个连接提供独立的地址缓冲区，对方地址另外获取
+    struct sockaddr_in raddr;
+    socklen_t raddr_len = sizeof(raddr);
+    memset(&raddr, 0, sizeof(raddr));
+    getpeername(cfd, (struct sockaddr *)&raddr, &raddr_len);
+    //对方地址的连接数或请求速率超过限制
+    bool counted;
+    if (!HTTPConn::admit(cfd, raddr, m_now, counted))
+    {
+        return;
+    }
+    Channel *ch = m_channels.acquire();
+    HTTPConn *conn = ch ? HTTPConn::new_conn() : NULL;
+    if (!conn)
+    {
+        if (ch)
+        {
+            m_channels.release(ch);
+        }
+        HTTPConn::release_admit(raddr, counted);
+        TRACE(TRACE_WARN, Trace::CONN_REJECTED, cfd, HTTPConn::m_user_count.load(), nullptr);
+        close(cfd);
+        return;
+    }
+    conn->init(cfd, raddr, -1, true, counted);
+    Stats::add(Stats::ACCEPTED);
+
+    ch->conn = conn;
+    ch->fd = cfd;
+    ch->inflight = 0;
+    ch->sending = false;
+    ch->closing = false;
+    ch->send_failed = false;
+    ch->pipe[0] = ch->pipe[1] = -1;
+    ch->pipe_len = 0;
+    conn->timer()->data = ch;
+    touch(ch);
+    submit_recv(ch);
+}
+
+void UringLoop::submit_recv(Channel *ch)
+{
+    struct io_uring_sqe *sqe = get_sqe(ch, OP_RECV);
+    if (!sqe)
+    {
+        close_channel(ch);
+        return;
+    }
+    //多射recv：每次有数据到达，内核从provided buffer中挑一个缓冲区接收，不需要重新提交
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ch->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+}
+
+void UringLoop::handle_recv(Channel *ch, int res, unsigned flags)
+{
+    bool more = flags & IORING_CQE_F_MORE;
+    if (!more)
+    {
+        ch->inflight--;
+    }
+    bool ok = res > 0;
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+        //数据复制到连接的读缓冲区之后，provided buffer立即还给内核
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (ok && !ch->closing)
+        {
+            Stats::add(Stats::BYTES_IN, res);
+            touch(ch);
+            ok = ch->conn->feed(m_ring.buffer(bid), res);
+        }
+        m_ring.recycle_buffer(bid);
+    }
+    if (ch->closing)
+    {
+        if (ch->inflight == 0)
+        {
+            release_channel(ch);
+        }
+        return;
+    }
+    if (!ok)
+    {
+        //provided buffer暂时用完，内核终止了多射recv，重新提交即可
+        if (res == -ENOBUFS && !more)
+        {
+            submit_recv(ch);
+            return;
+        }
+        close_channel(ch);
+        return;
+    }
+    if (!more)
+    {
+        submit_recv(ch);
+    }
+    //正在发送时只接收数据，这一批响应发送完之后再解析
+    if (!ch->sending)
+    {
+        process(ch);
+    }
+}
+
+void UringLoop::process(Channel *ch)
+{
+    if (!ch->conn->handle_requests())
+    {
+        close_channel(ch);
+        return;
+    }
+    if (ch->conn->response_pending())
+    {
+        ch->sending = true;
+        submit_send(ch);
+    }
+}
+
+void UringLoop::submit_send(Channel *ch)
+{
+    int fd;
+    off_t offset, len;
+    if (ch->conn->sendfile_range(fd, offset, len) || ch->pipe_len > 0)
+    {
+        submit_splice(ch);
+        return;
+    }
+    bool more = false;
+    memset(&ch->msg, 0, sizeof(ch->msg));
+    ch->msg.msg_iov = ch->conn->iov();
+    ch->msg.msg_iovlen = ch->conn->prepare_iov(more);
+    struct io_uring_sqe *sqe = get_sqe(ch, OP_SEND);
+    if (!sqe)
+    {
+        close_channel(ch);
+        return;
+    }
+    /*MSG_MORE告诉内核后面还有数据，响应头会和文件的第一段数据合并成满的TCP报文段*/
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = ch->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&ch->msg;
+    sqe->len = 1;
+    sqe->msg_flags = more ? MSG_MORE : 0;
+}
+
+/*大文件的消息体：splice(文件 -> 管道)和splice(管道 -> socket)链接成一组提交，
+第一个完成之后内核才执行第二个，数据不经过用户态。socket发送不完时，剩下的数据留在管道中，下次先把管道发空*/
+void UringLoop::submit_splice(Channel *ch)
+{
+    if (ch->pipe[0] == -1)
+    {
+        if (!m_pipes.empty())
+        {
+            ch->pipe[1] = m_pipes.back();
+            m_pipes.pop_back();
+            ch->pipe[0] = m_pipes.back();
+            m_pipes.pop_back();
+        }
+        else if (pipe2(ch->pipe, O_CLOEXEC) == -1)
+        {
+            ch->pipe[0] = ch->pipe[1] = -1;
+            close_channel(ch);
+            return;
+        }
+        else
+        {
+            //管道越大，一组splice能发送的数据越多；超过系统上限时使用内核实际给出的大小
+            m_pipe_size = fcntl(ch->pipe[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+            if (m_pipe_size <= 0)
+            {
+                m_pipe_size = fcntl(ch->pipe[1], F_GETPIPE_SZ);
+            }
+        }
+    }
+    if (m_ring.sq_space() < 2)
+    {
+        m_ring.submit_and_wait(0);
+    }
+    int out_len = ch->pipe_len;
+    if (out_len == 0)
+    {
+        int fd;
+        off_t offset, len;
+        ch->conn->sendfile_range(fd, offset, len);
+        out_len = len < m_pipe_size ? len : m_pipe_size;
+        struct io_uring_sqe *sqe = get_sqe(ch, OP_SPLICE_IN);
+        if (!sqe)
+        {
+            close_channel(ch);
+            return;
+        }
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = fd;
+        sqe->splice_off_in = offset;
+        sqe->fd = ch->pipe[1];
+        sqe->off = (uint64_t)-1;
+        sqe->len = out_len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->flags = IOSQE_IO_LINK;
+    }
+    struct io_uring_sqe *sqe = get_sqe(ch, OP_SPLICE_OUT);
+    if (!sqe)
+    {
+        close_channel(ch);
+        return;
+    }
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = ch->pipe[0];
+    sqe->splice_off_in = (uint64_t)-1;
+    sqe->fd = ch->fd;
+    sqe->off = (uint64_t)-1;
+    sqe->len = out_len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+}
+
+/*splice不会像sendmsg那样在socket不可写时由内核等待，需要自己等POLLOUT之后再提交*/
+void UringLoop::submit_poll_out(Channel *ch)
+{
+    struct io_uring_sqe *sqe = get_sqe(ch, OP_POLL_OUT);
+    if (!sqe)
+    {
+        close_channel(ch);
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = ch->fd;
+    sqe->poll32_events = POLLOUT;
+}
+
+void UringLoop::handle_send(Channel *ch, OP op, int res)
+{
+    ch->inflight--;
+    if (ch->closing)
+    {
+        if (ch->inflight == 0)
+        {
+            release_channel(ch);
+        }
+        return;
+    }
+    switch (op)
+    {
+    case OP_SEND:
+    {
+        if (res < 0)
+        {
+            close_channel(ch);
+            return;
+        }
+        touch(ch);
+        ch->conn->consume(res);
+        break;
+    }
+    case OP_SPLICE_IN:
+    {
+        //文件读到了末尾之前就结束（比如文件被截断），链接的splice-out会被取消
+        if (res > 0)
+        {
+            ch->pipe_len += res;
+        }
+        else
+        {
+            ch->send_failed = true;
+        }
+        return;
+    }
+    case OP_SPLICE_OUT:
+    {
+        if (res == -EAGAIN)
+        {
+            Stats::add(Stats::WRITE_EAGAIN);
+            submit_poll_out(ch);
+            return;
+        }
+        //splice-in读入的字节数不足时链接的splice-out被取消，下次先发送管道中已有的数据
+        if (res == -ECANCELED)
+        {
+            break;
+        }
+        if (res < 0)
+        {
+            close_channel(ch);
+            return;
+        }
+        touch(ch);
+        ch->pipe_len -= res;
+        ch->conn->consume(res);
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+    if (ch->send_failed)
+    {
+        close_channel(ch);
+        return;
+    }
+    continue_send(ch);
+}
+
+void UringLoop::continue_send(Channel *ch)
+{
+    if (ch->conn->response_pending() || ch->pipe_len > 0)
+    {
+        submit_send(ch);
+        return;
+    }
+    //一批响应发送完毕，管道还回管道池
+    ch->sending = false;
+    if (ch->pipe[0] != -1)
+    {
+        m_pipes.push_back(ch->pipe[0]);
+        m_pipes.push_back(ch->pipe[1]);
+        ch->pipe[0] = ch->pipe[1] = -1;
+    }
+    //读缓冲区中已有的后续请求在finish_batch中解析
+    if (!ch->conn->finish_batch())
+    {
+        close_channel(ch);
+        return;
+    }
+    if (ch->conn->response_pending())
+    {
+        ch->sending = true;
+        submit_send(ch);
+    }
+}
+
+void UringLoop::close_channel(Channel *ch)
+{
+    if (ch->closing)
+    {
+        return;
+    }
+    ch->closing = true;
+    m_wheel.delClock(ch->conn->timer());
+    //shutdown之后，多射recv、等待中的发送和poll都会立即完成
+    shutdown(ch->fd, SHUT_RDWR);
+    if (ch->inflight == 0)
+    {
+        release_channel(ch);
+    }
+}
+
+void UringLoop::release_channel(Channel *ch)
+{
+    if (ch->pipe[0] != -1)
+    {
+        //管道中还有没发出去的数据，不能再给别的连接使用
+        if (ch->pipe_len == 0)
+        {
+            m_pipes.push_back(ch->pipe[0]);
+            m_pipes.push_back(ch->pipe[1]);
+        }
+        else
+        {
+            close(ch->pipe[0]);
+            close(ch->pipe[1]);
+        }
+    }
+    ch->conn->close_conn(true);
+    m_channels.release(ch);
+}
+
+void UringLoop::touch(Channel *ch)
+{
+    int timeout = ch->conn->touch(m_now);
+    if (HTTPConn::min_timeout() > 0)
+    {
+        m_wheel.addClock(ch->conn->timer(), timeout);
+    }
+}
+
+void UringLoop::submit_timer()
+{
+    struct io_uring_sqe *sqe = get_sqe(NULL, OP_TIMER);
+    if (!sqe)
+    {
+        printf("io_uring submit timer failure\n");
+        return;
+    }
+    long wait = m_next_tick > m_now ? m_next_tick - m_now : 0;
+    m_tick_ts.tv_sec = wait / 1000;
+    m_tick_ts.tv_nsec = wait % 1000 * 1000000;
+    //off为0：不等待其他请求完成，只是一个定时器，到期时res为-ETIME
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&m_tick_ts;
+    sqe->len = 1;
+}
+
+void UringLoop::handle_timer()
+{
+    while (m_now >= m_next_tick)
+    {
+        m_wheel.tick([this](TimeWheelTimer *timer) { handle_timeout((Channel *)timer->data); });
+        m_next_tick += m_wheel.slot_ms();
+    }
+    submit_timer();
+}
+
+/*定时器到期时按连接实际所处的阶段检查，没有超时就按剩余时间重新设置*/
+void UringLoop::handle_timeout(Channel *ch)
+{
+    int remain;
+    if (ch->conn->expired(m_now, remain))
+    {
+        close_channel(ch);
+        return;
+    }
+    m_wheel.addClock(ch->conn->timer(), remain);
+}
+
+void UringLoop::stop_accept()
+{
+    uint64_t one = 1;
+    if (write(m_wakefd, &one, sizeof(one)) == -1)
+    {
+        printf("wake event loop failure\n");
+    }
+}
+
+void UringLoop::submit_wake()
+{
+    struct io_uring_sqe *sqe = get_sqe(NULL, OP_WAKE);
+    if (!sqe)
+    {
+        printf("io_uring submit wake failure\n");
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_wakefd;
+    sqe->addr = (uint64_t)(uintptr_t)&m_wake_value;
+    sqe->len = sizeof(m_wake_value);
+}
+
+void UringLoop::handle_wake()
+{
+    //取消请求自己的完成事件也是OP_WAKE，这时监听socket已经关闭
+    if (m_listenfd == -1)
+    {
+        return;
+    }
+    /*多射accept持有监听socket的引用，关闭文件描述符不会结束它，按user_data取消（accept的user_data是OP_ACCEPT，连接指针为空）。
+    监听socket在新进程中仍然打开，这里只关闭本进程中的引用*/
+    struct io_uring_sqe *sqe = get_sqe(NULL, OP_WAKE);
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uint64_t)OP_ACCEPT;
+    }
+    close(m_listenfd);
+    m_listenfd = -1;
+    //按退出时的规则重新检查所有连接的定时器，空闲的长连接在DRAIN_IDLE_TIMEOUT之后关闭
+    std::vector<Channel *> chs;
+    m_wheel.for_each([&chs](TimeWheelTimer *timer) { chs.push_back((Channel *)timer->data); });
+    for (size_t i = 0; i < chs.size(); i++)
+    {
+        handle_timeout(chs[i]);
+    }
+}
+
+void UringLoop::loop()
+{
+    submit_accept();
+    submit_wake();
+    //没有任何超时限制时不需要转动时间轮
+    if (HTTPConn::min_timeout() > 0)
+    {
+        submit_timer();
+    }
+    struct io_uring_cqe cqes[MAX_CQES];
+    while (1)
+    {
+        //上一轮产生的所有请求在这里一次提交，同时等待新的完成事件
+        int ret = m_ring.submit_and_wait(1);
+        if (ret < 0 && errno != EINTR && errno != EBUSY)
+        {
+            printf("io_uring enter failure\n");
+            break;
+        }
+        unsigned n;
+        while ((n = m_ring.copy_cqes(cqes, MAX_CQES)) > 0)
+        {
+            m_now = TimeWheel::now();
+            long start = Stats::now();
+            for (unsigned i = 0; i < n; i++)
+            {
+                Channel *ch = (Channel *)(uintptr_t)(cqes[i].user_data & ~(uint64_t)7);
+                OP op = (OP)(cqes[i].user_data & 7);
+                switch (op)
+                {
+                case OP_ACCEPT:
+                    handle_accept(cqes[i].res, cqes[i].flags);
+                    break;
+                case OP_RECV:
+                    handle_recv(ch, cqes[i].res, cqes[i].flags);
+                    break;
+                case OP_TIMER:
+                    handle_timer();
+                    break;
+                case OP_WAKE:
+                    handle_wake();
+                    break;
+                default:
+                    handle_send(ch, op, cqes[i].res);
+                    break;
+                }
+            }
+            Stats::record(Stats::STAGE_LOOP, Stats::now() - start);
+        }
+    }
+}
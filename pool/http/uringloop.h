@@ -0,0 +1,121 @@
+/**
+  * @file    :uringloop.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :基于io_uring的事件循环，与EventLoop一样一个对象对应一个监听socket，连接固定在accept它的事件循环上。
+  * 多射accept接受新连接，多射recv从provided buffer中接收数据，响应头和小文件用sendmsg发送，
+  * 大文件用一对链接（IOSQE_IO_LINK）的splice经过管道发送；每轮循环产生的所有请求用一次io_uring_enter提交。
+  * 请求的解析和响应的生成仍由HTTPConn完成，在事件循环线程中直接执行，不经过线程池。
+  * 时间轮由一个周期性的IORING_OP_TIMEOUT驱动，超时的连接和出错的连接一样关闭
+*/
+
+#ifndef __URINGLOOP_H
+#define __URINGLOOP_H
+
+#include <pthread.h>
+#include <vector>
+#include "uring.h"
+#include "objpool.h"
+#include "http.h"
+#include "timewheel.h"
+
+class UringLoop
+{
+public:
+    /*lfd是本事件循环独占的监听socket，内核不支持io_uring时抛出异常*/
+    explicit UringLoop(int lfd);
+    ~UringLoop();
+
+    //创建一个线程运行事件循环
+    bool start();
+    //等待事件循环线程结束
+    void join();
+    //在当前线程中运行事件循环
+    void loop();
+    /*平滑升级：让事件循环停止accept并关闭空闲的长连接，已有的连接继续处理。
+    由升级线程调用，事件循环读eventfd的请求随之完成*/
+    void stop_accept();
+
+private:
+    /*提交队列和完成队列的大小、provided buffer的个数和大小、管道的容量（一组splice经过管道的最大字节数）*/
+    static const unsigned RING_ENTRIES = 4096;
+    static const unsigned BUFFER_COUNT = 1024;
+    static const unsigned BUFFER_SIZE = 4096;
+    static const unsigned short BUFFER_GROUP = 0;
+    static const int SPLICE_CHUNK = 1 << 20;
+    static const int MAX_CQES = 512;
+
+    /*请求类型，保存在user_data的低3位，其余位是Channel指针*/
+    enum OP
+    {
+        OP_ACCEPT = 0,
+        OP_RECV,
+        OP_SEND,
+        OP_SPLICE_IN,
+        OP_SPLICE_OUT,
+        OP_POLL_OUT,
+        OP_TIMER,
+        OP_WAKE
+    };
+
+    /*一个连接在事件循环中的状态。关闭连接时先shutdown，等所有已提交的请求都完成之后
+    才归还HTTPConn，因为内核可能还在访问它的缓冲区*/
+    struct Channel
+    {
+        HTTPConn *conn;
+        int fd;
+        int inflight;     //已提交、尚未完成的请求数，多射recv在结束之前算一个
+        bool sending;     //是否正在发送一批响应
+        bool closing;     //连接正在关闭
+        bool send_failed; //splice从文件读入管道失败
+        int pipe[2];      //splice使用的管道，需要时才从管道池中取出
+        int pipe_len;     //管道中尚未发送到socket的字节数
+        struct msghdr msg;
+    };
+
+    static void *worker(void *arg);
+    struct io_uring_sqe *get_sqe(Channel *ch, OP op);
+
+    void submit_accept();
+    void handle_accept(int res, unsigned flags);
+    void submit_recv(Channel *ch);
+    void handle_recv(Channel *ch, int res, unsigned flags);
+    //发送响应队列中当前位置的数据：内存数据用sendmsg，sendfile消息体用splice
+    void submit_send(Channel *ch);
+    void submit_splice(Channel *ch);
+    void submit_poll_out(Channel *ch);
+    void handle_send(Channel *ch, OP op, int res);
+    //当前的数据发送完毕，继续发送，或者一批响应全部发送完毕后解析读缓冲区中的后续请求
+    void continue_send(Channel *ch);
+    //解析读缓冲区中的请求，生成了响应就开始发送
+    void process(Channel *ch);
+    //关闭连接：shutdown让已提交的请求尽快完成，全部完成之后再释放
+    void close_channel(Channel *ch);
+    void release_channel(Channel *ch);
+    //连接上有活动：记录活动时间，重新设置定时器
+    void touch(Channel *ch);
+    //提交下一次转动时间轮的定时请求
+    void submit_timer();
+    //定时请求完成：转动时间轮，处理到期的定时器
+    void handle_timer();
+    void handle_timeout(Channel *ch);
+    //提交读eventfd的请求，完成时（升级线程要求停止accept）取消多射accept，检查所有连接
+    void submit_wake();
+    void handle_wake();
+
+private:
+    IOUring m_ring;
+    int m_listenfd;           //本事件循环的监听socket，停止accept之后为-1
+    int m_wakefd;             //升级线程唤醒事件循环的eventfd
+    uint64_t m_wake_value;    //读eventfd的缓冲区
+    pthread_t m_thread;
+    ObjectPool<Channel> m_channels;
+    std::vector<int> m_pipes; //空闲的管道，每两个文件描述符一组
+    int m_pipe_size;          //管道的容量，一组splice最多发送这么多字节
+    TimeWheel m_wheel;        //本事件循环所有连接的定时器
+    long m_now;               //本轮循环的当前时间（毫秒）
+    long m_next_tick;         //时间轮下一次转动的时间
+    struct __kernel_timespec m_tick_ts; //定时请求的超时时间，内核在请求完成前读取
+};
+
+#endif
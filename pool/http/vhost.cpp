@@ -0,0 +1,234 @@
+/**
+  * @file    :vhost.cpp
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :vhost.h的源文件
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vhost.h"
+
+HostTable::~HostTable()
+{
+    for (size_t i = 0; i < m_hosts.size(); i++)
+    {
+        if (m_hosts[i]->upload_dirfd != -1)
+        {
+            close(m_hosts[i]->upload_dirfd);
+        }
+        delete m_hosts[i];
+    }
+}
+
+bool HostTable::set_root(VirtualHost *host, const char *root)
+{
+    struct stat st;
+    int len = strlen(root);
+    while (len > 1 && root[len - 1] == '/')
+    {
+        len--;
+    }
+    if (root[0] != '/' || len > MAX_ROOT_LEN || stat(root, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        return false;
+    }
+    //根目录是"/"时去掉末尾的'/'，URL本身以'/'开头
+    host->root.assign(root, len == 1 ? 0 : len);
+    return true;
+}
+
+bool HostTable::set_upload(VirtualHost *host, const char *dir)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+    host->upload_dirfd = fd;
+    return true;
+}
+
+bool HostTable::set_default(const char *root, const char *upload_dir)
+{
+    VirtualHost *host = new VirtualHost;
+    m_hosts.push_back(host);
+    if (!set_root(host, root) || (upload_dir && !set_upload(host, upload_dir)))
+    {
+        return false;
+    }
+    m_default = host;
+    return true;
+}
+
+bool HostTable::load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        printf("open host table %s failure\n", path);
+        return false;
+    }
+    char line[1024];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        ok = parse_line(line);
+        if (!ok)
+        {
+            printf("%s:%d: bad virtual host\n", path, lineno);
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+bool HostTable::parse_line(char *line)
+{
+    char *comment = strchr(line, '#');
+    if (comment)
+    {
+        *comment = '\0';
+    }
+    char *save = NULL;
+    char *names = strtok_r(line, " \t\r\n", &save);
+    if (!names)
+    {
+        return true; //空行
+    }
+    char *root = strtok_r(NULL, " \t\r\n", &save);
+    if (!root)
+    {
+        return false;
+    }
+    VirtualHost *host = new VirtualHost;
+    m_hosts.push_back(host);
+    if (!set_root(host, root))
+    {
+        return false;
+    }
+    for (char *opt = strtok_r(NULL, " \t\r\n", &save); opt; opt = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (strncmp(opt, "upload=", 7) == 0)
+        {
+            if (host->upload_dirfd != -1 || !set_upload(host, opt + 7))
+            {
+                return false;
+            }
+            continue;
+        }
+        char *end;
+        if (strncmp(opt, "cache-small=", 12) == 0)
+        {
+            host->cache_small = strtol(opt + 12, &end, 10);
+        }
+        else if (strncmp(opt, "cache-ttl=", 10) == 0)
+        {
+            host->cache_ttl = strtol(opt + 10, &end, 10);
+        }
+        else if (strncmp(opt, "max-body=", 9) == 0)
+        {
+            host->max_body = strtol(opt + 9, &end, 10);
+        }
+        else if (strncmp(opt, "body-timeout=", 13) == 0)
+        {
+            long seconds = strtol(opt + 13, &end, 10);
+            host->body_timeout = seconds >= 0 && seconds <= 86400 ? seconds * 1000 : -2;
+        }
+        else
+        {
+            return false;
+        }
+        if (*end != '\0' || end == strchr(opt, '=') + 1 || host->cache_small < -1 || host->cache_ttl < -1 ||
+            host->max_body < -1 || host->body_timeout < -1)
+        {
+            return false;
+        }
+    }
+
+    //同一个网站的多个主机名用逗号分隔，主机名统一保存为小写
+    char *name_save = NULL;
+    for (char *name = strtok_r(names, ",", &name_save); name; name = strtok_r(NULL, ",", &name_save))
+    {
+        if (strcmp(name, "default") == 0)
+        {
+            m_default = host;
+            continue;
+        }
+        std::string key(name);
+        for (size_t i = 0; i < key.size(); i++)
+        {
+            key[i] = tolower((unsigned char)key[i]);
+        }
+        if (key.size() > MAX_HOST_LEN || m_table.count(key))
+        {
+            return false;
+        }
+        m_names.push_back(key);
+        m_table.emplace(m_names.back(), host);
+    }
+    return true;
+}
+
+const VirtualHost *HostTable::find(const char *host) const
+{
+    if (!host || m_table.empty())
+    {
+        return m_default;
+    }
+    /*主机名转成小写，去掉端口和末尾的'.'。IPv6字面量的端口在']'之后*/
+    char key[MAX_HOST_LEN + 1];
+    const char *end = host[0] == '[' ? strchr(host, ']') : strchr(host, ':');
+    int len = end ? end - host + (host[0] == '[') : strlen(host);
+    while (len > 0 && (host[len - 1] == '.' || host[len - 1] == ' ' || host[len - 1] == '\t'))
+    {
+        len--;
+    }
+    if (len > MAX_HOST_LEN)
+    {
+        return m_default;
+    }
+    for (int i = 0; i < len; i++)
+    {
+        key[i] = tolower((unsigned char)host[i]);
+    }
+    auto it = m_table.find(std::string_view(key, len));
+    return it == m_table.end() ? m_default : it->second;
+}
+
+const VirtualHost *HostTable::get(const char *name) const
+{
+    if (strcasecmp(name, "default") == 0)
+    {
+        return m_default;
+    }
+    std::string key(name);
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        key[i] = tolower((unsigned char)key[i]);
+    }
+    auto it = m_table.find(key);
+    return it == m_table.end() ? nullptr : it->second;
+}
+
+int HostTable::min_body_timeout() const
+{
+    int timeout = 0;
+    for (size_t i = 0; i < m_hosts.size(); i++)
+    {
+        int t = m_hosts[i]->body_timeout;
+        if (t > 0 && (timeout == 0 || t < timeout))
+        {
+            timeout = t;
+        }
+    }
+    return timeout;
+}
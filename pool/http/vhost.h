@@ -0,0 +1,80 @@
+/**
+  * @file    :vhost.h
+  * @author  :zhl
+  * @date    :2026-10-17
+  * @desc    :虚拟主机表：按请求的Host头部字段选择文档根目录、上传目录、文件缓存策略和请求限制（消息体大小、接收超时），
+  * 一个服务器进程服务多个网站，连接对象池、线程池和文件缓存由所有网站共享。
+  * 主机表在启动时从配置文件加载，之后只读，事件循环和工作线程查找时不加锁
+*/
+
+#ifndef __VHOST_H
+#define __VHOST_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+
+/*一个网站*/
+struct VirtualHost
+{
+    VirtualHost() : upload_dirfd(-1), cache_small(-1), cache_ttl(-1), max_body(-1), body_timeout(-1) {}
+
+    std::string root; //文档根目录，末尾没有'/'
+    int upload_dirfd; //PUT上传的目录，-1表示不允许上传
+    int cache_small;  //小于该字节数的文件常驻内存，-1表示使用--cache-small
+    int cache_ttl;    //缓存项的有效期（毫秒），-1表示使用--cache-ttl
+    long max_body;    //请求消息体的最大字节数，超过时回复413，-1表示不限制
+    int body_timeout; //接收消息体时两次收到数据的最大间隔（毫秒），0表示不限制，-1表示使用--body-timeout
+};
+
+class HostTable
+{
+public:
+    /*文档根目录的最大长度，根目录加上URL要放得下HTTPConn::FILENAME_LEN*/
+    static const int MAX_ROOT_LEN = 100;
+    /*主机名的最大长度*/
+    static const int MAX_HOST_LEN = 255;
+
+    HostTable() : m_default(nullptr) {}
+    ~HostTable();
+
+    /*设置默认主机：Host头部字段缺失或者不在表中时使用。upload_dir为空时不允许上传。
+    目录无法打开时返回false*/
+    bool set_default(const char *root, const char *upload_dir);
+
+    /*从配置文件加载虚拟主机，每行一个网站：
+        主机名[,主机名...]  文档根目录  [upload=上传目录] [cache-small=字节数] [cache-ttl=毫秒]
+                                        [max-body=字节数] [body-timeout=秒]
+    '#'开始的是注释。主机名为default的一行替换默认主机。出错时打印文件名和行号，返回false*/
+    bool load(const char *path);
+
+    /*按Host头部字段的值查找网站：不区分大小写，忽略端口和末尾的'.'，找不到时返回默认主机*/
+    const VirtualHost *find(const char *host) const;
+    /*按配置中的主机名（不区分大小写，"default"表示默认主机）查找网站，不在表中时返回空*/
+    const VirtualHost *get(const char *name) const;
+
+    //配置的主机名数量，不含默认主机
+    int size() const { return m_table.size(); }
+    //所有网站中最短的消息体超时（毫秒），都没有设置时返回0
+    int min_body_timeout() const;
+
+private:
+    //解析配置文件中的一行，格式错误时返回false
+    bool parse_line(char *line);
+    //检查并保存目录设置
+    static bool set_root(VirtualHost *host, const char *root);
+    static bool set_upload(VirtualHost *host, const char *dir);
+
+private:
+    /*所有网站，包括默认主机，由主机表负责释放*/
+    std::vector<VirtualHost *> m_hosts;
+    /*小写的主机名到网站的索引，一个网站可以有多个主机名。键指向m_names中的字符串（deque追加时不移动已有元素），
+    查找时用栈上的小写副本构造键，不分配内存*/
+    std::deque<std::string> m_names;
+    std::unordered_map<std::string_view, VirtualHost *> m_table;
+    VirtualHost *m_default;
+};
+
+#endif
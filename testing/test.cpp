@@ -1,7 +1,13 @@
 /**
  * @author: fenghaze
  * @date: 2021/05/08 19:53
- * @desc: 使用epoll模型实现客户端，对服务器进行压力测试
+ * @desc: 对服务器进行压力测试的HTTP负载生成器，每个线程一个epoll循环，负责一部分连接。
+ * 闭环模式：每个连接始终保持pipeline个请求在途，收到一个响应就发送下一个，测的是最大吞吐量；
+ * 开环模式（-R）：按固定速率安排请求，与服务器是否及时响应无关。服务器变慢时请求在客户端排队，
+ * 延迟从计划发送的时间算起（修正协调遗漏，coordinated omission），这样测出的尾部延迟才是用户实际看到的。
+ * 另外统计新连接从connect到收到第一个响应的时间，用于观察连接风暴下的accept延迟。
+ * 编译：g++ -O2 -pthread test.cpp -o test
+ * 用法：./test [-c conns] [-t threads] [-d seconds] [-R rate] [-p pipeline] [-k 0|1] [-f mixfile] [-u path] host port
  */
 
 #include <stdlib.h>
@@ -9,16 +15,178 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <string>
+#include <vector>
+#include <deque>
 
-#define MAX_EVENTS_NUM 10000
-#define BUFFERSIZE 2048
+#define MAX_EVENTS_NUM 1024
+#define BUFFERSIZE 65536
 
-/*每个客户连接不停地向服务器发送这个请求*/
-static const char *request = "GET http://localhost/index.html HTTP/1.1\r\nConnection:keep-alive\r\n\r\nxxxxxxxxxxxx";
+/*命令行参数*/
+struct Options
+{
+    const char *host;
+    int port;
+    int conns;           //总连接数，平均分给各个线程
+    int threads;         //线程数
+    int duration;        //测试时长（秒）
+    double rate;         //开环模式的总请求速率（每秒），0为闭环模式
+    int depth;           //每个连接最多同时在途的请求数（流水线深度）
+    bool keepalive;      //是否使用长连接，关闭时每个请求一个新连接
+    const char *mix;     //请求组合文件，每行"[权重] 路径"
+    const char *path;    //没有请求组合文件时请求的路径
+};
+
+static Options opt = {NULL, 0, 100, 4, 10, 0, 1, true, NULL, "/index.html"};
+static struct sockaddr_in server_addr;
+
+/*请求组合：每个请求一个预先生成的请求报文和累积权重，按权重随机选择*/
+static std::vector<std::string> requests;
+static std::vector<double> weights;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*对数-线性分桶的延迟直方图：每个2的幂区间等分成16个桶，相对误差不超过1/16*/
+class Histogram
+{
+public:
+    Histogram() : m_counts(BUCKETS, 0), m_total(0), m_max(0), m_sum(0) {}
+
+    void record(long ns)
+    {
+        unsigned long v = ns > 0 ? ns : 0;
+        m_counts[bucket(v)]++;
+        m_total++;
+        m_sum += v;
+        if (v > m_max)
+        {
+            m_max = v;
+        }
+    }
+
+    void merge(const Histogram &h)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            m_counts[i] += h.m_counts[i];
+        }
+        m_total += h.m_total;
+        m_sum += h.m_sum;
+        if (h.m_max > m_max)
+        {
+            m_max = h.m_max;
+        }
+    }
+
+    //第q分位数（纳秒），取所在桶的上界
+    unsigned long percentile(double q) const
+    {
+        unsigned long rank = q * m_total;
+        unsigned long seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += m_counts[i];
+            if (seen > rank)
+            {
+                unsigned long upper = bucket_upper(i);
+                return upper < m_max ? upper : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    unsigned long total() const { return m_total; }
+    unsigned long max() const { return m_max; }
+    double mean() const { return m_total ? (double)m_sum / m_total : 0; }
+
+private:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_EXP = 40;
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+    static int bucket(unsigned long v)
+    {
+        if (v < (unsigned long)SUB_COUNT)
+        {
+            return v;
+        }
+        int exp = 63 - __builtin_clzl(v);
+        if (exp > MAX_EXP)
+        {
+            return BUCKETS - 1;
+        }
+        return (exp - SUB_BITS + 1) * SUB_COUNT + ((v >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    static unsigned long bucket_upper(int idx)
+    {
+        if (idx < SUB_COUNT)
+        {
+            return idx;
+        }
+        int exp = idx / SUB_COUNT + SUB_BITS - 1;
+        unsigned long sub = idx % SUB_COUNT;
+        return ((SUB_COUNT + sub + 1) << (exp - SUB_BITS)) - 1;
+    }
+
+    std::vector<unsigned long> m_counts;
+    unsigned long m_total;
+    unsigned long m_max;
+    unsigned long m_sum;
+};
+
+/*一个客户连接*/
+struct Conn
+{
+    int fd;
+    bool connected;           //非阻塞connect是否已经完成
+    std::string out;          //尚未发送出去的请求数据
+    std::string in;           //收到的、尚未解析完的响应数据
+    std::deque<long> inflight; //在途请求的起始时间：闭环模式是实际发送时间，开环模式是计划发送时间
+    long opened;              //开始建立连接的时间
+    bool answered;            //是否已经收到第一个响应
+};
+
+/*一个工作线程：独占一个epoll实例和一部分连接，统计数据在结束后汇总*/
+struct Worker
+{
+    pthread_t tid;
+    int epfd;
+    int timerfd;           //开环模式下按计划发送时间唤醒
+    std::vector<Conn> conns;
+    double interval;       //开环模式下本线程相邻两个请求的计划间隔（纳秒）
+    long next_send;        //下一个请求的计划发送时间
+    long armed;            //定时器当前设置的唤醒时间
+    std::deque<long> backlog; //已经到了计划时间、但所有连接的流水线都满了的请求
+    size_t rr;             //开环模式轮流选择连接
+    unsigned int seed;
+    Histogram hist;
+    Histogram connect_hist; //新连接从connect到收到第一个响应的时间，包含服务器accept之前在队列中等待的时间
+    long done;             //完成的请求数
+    long errors;           //连接出错时丢失的在途请求数
+    long unfinished;       //测试结束时仍未完成的请求数（只在开环模式统计）
+    long bytes_in;
+    long status[6];        //按状态码的百位统计，status[0]是无法解析的响应
+    long reconnects;
+};
 
 int setnonblocking(int fd)
 {
@@ -28,133 +196,578 @@ int setnonblocking(int fd)
     return old_opt;
 }
 
-void addfd(int epfd, int fd)
+static std::string build_request(const char *path)
 {
-    epoll_event ev;
-    ev.data.fd = fd;
-    ev.events = EPOLLOUT | EPOLLET | EPOLLERR; //监听可写事件
-    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
-    setnonblocking(fd);
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+             path, opt.host, opt.keepalive ? "keep-alive" : "close");
+    return buf;
 }
 
-//向服务端ip port发送nums个连接请求
-void start_conn(int epfd, int nums, const char *ip, int port)
+//读取请求组合文件，每行"[权重] 路径"，#开头的行是注释
+static bool load_mix(const char *file)
 {
-    int ret = 0;
-    struct sockaddr_in raddr;
-    //配置服务端socket
-    raddr.sin_family = AF_INET;
-    raddr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &raddr.sin_addr);
-
-    //发送连接请求
-    for (size_t i = 0; i < nums; i++)
+    FILE *fp = fopen(file, "r");
+    if (!fp)
+    {
+        perror(file);
+        return false;
+    }
+    char line[1024];
+    double total = 0;
+    while (fgets(line, sizeof(line), fp))
     {
-        sleep(1);
-        //创建与服务端通信的socket
-        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-        printf("create 1 sock\n");
-        if (sockfd < 1)
+        char a[1000], b[1000];
+        int n = sscanf(line, "%999s %999s", a, b);
+        if (n <= 0 || a[0] == '#')
         {
             continue;
         }
-        //请求连接，如果连接建立成功，说明可以开始写入数据，监听可写事件
-        if (connect(sockfd, (struct sockaddr *)&raddr, sizeof(raddr)) == 0)
+        double w = 1;
+        const char *path = a;
+        if (n == 2)
+        {
+            w = atof(a);
+            path = b;
+        }
+        if (w <= 0 || path[0] != '/')
         {
-            printf("build connection\n", i);
-            addfd(epfd, sockfd);
+            fprintf(stderr, "bad line in %s: %s", file, line);
+            fclose(fp);
+            return false;
         }
+        total += w;
+        requests.push_back(build_request(path));
+        weights.push_back(total);
     }
+    fclose(fp);
+    return !requests.empty();
 }
 
-//从服务器读取数据
-bool read_once(int fd, char *buffer, int len)
+static const std::string &pick_request(Worker *w)
 {
-    int bytes_read = 0;
-    memset(buffer, '\0', len);
-    bytes_read = recv(fd, buffer, len, 0);
-    if (bytes_read == -1)
+    if (requests.size() == 1)
     {
-        return false;
+        return requests[0];
     }
-    else if (bytes_read == 0)
+    double r = (double)rand_r(&w->seed) / RAND_MAX * weights.back();
+    size_t i = 0;
+    while (i + 1 < requests.size() && weights[i] < r)
     {
-        return false;
+        i++;
     }
-    printf("read in %d bytes from socket %d with content: %s\n", bytes_read, fd, buffer);
-    return true;
+    return requests[i];
+}
+
+static void update_events(Worker *w, Conn &c)
+{
+    epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events = EPOLLIN | (c.out.empty() && c.connected ? 0u : (uint32_t)EPOLLOUT);
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, c.fd, &ev);
 }
 
-bool write_bytes(int fd, const char *buffer, int len)
+//非阻塞地建立连接，连接完成时产生EPOLLOUT
+static void open_conn(Worker *w, Conn &c)
 {
-    int bytes_write = 0;
-    printf("write out %d bytes to socket %d\n", len, fd);
-    while (1)
+    c.fd = socket(AF_INET, SOCK_STREAM, 0);
+    c.connected = false;
+    c.opened = now_ns();
+    c.answered = false;
+    c.out.clear();
+    c.in.clear();
+    c.inflight.clear();
+    if (c.fd < 0)
+    {
+        perror("socket");
+        exit(1);
+    }
+    setnonblocking(c.fd);
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c.fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
     {
-        bytes_write = send(fd, buffer, len, 0);
-        if (bytes_write == -1 || bytes_write == 0)
+        perror("connect");
+        exit(1);
+    }
+    epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events = EPOLLIN | EPOLLOUT;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+//关闭连接，在途请求算作错误（已经完成的不算），然后重新连接
+static void reopen_conn(Worker *w, Conn &c)
+{
+    w->errors += c.inflight.size();
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c.fd, 0);
+    close(c.fd);
+    w->reconnects++;
+    open_conn(w, c);
+}
+
+//发送缓冲区中的数据，返回false表示连接出错
+static bool flush(Worker *w, Conn &c)
+{
+    while (!c.out.empty())
+    {
+        int n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n < 0)
         {
+            if (errno == EAGAIN)
+            {
+                break;
+            }
             return false;
         }
-        len -= bytes_write;    //剩余的字符长度
-        buffer += bytes_write; //剩余字符串的首地址
-        if (len <= 0)
+        c.out.erase(0, n);
+    }
+    update_events(w, c);
+    return true;
+}
+
+//在连接上发送一个请求，start是计算延迟的起点
+static void send_request(Worker *w, Conn &c, long start)
+{
+    c.out += pick_request(w);
+    c.inflight.push_back(start);
+    if (c.connected && !flush(w, c))
+    {
+        reopen_conn(w, c);
+    }
+}
+
+//解析收到的完整响应，返回解析出的响应数，连接需要关闭时close_after置为true
+static int parse_responses(Worker *w, Conn &c, long now, bool &close_after)
+{
+    int count = 0;
+    size_t pos = 0;
+    while (true)
+    {
+        size_t end = c.in.find("\r\n\r\n", pos);
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        const char *head = c.in.c_str() + pos;
+        long len = 0;
+        const char *cl = strcasestr(head, "\r\nContent-Length:");
+        if (cl && cl < c.in.c_str() + end)
+        {
+            len = atol(cl + 17);
+        }
+        if (c.in.size() < end + 4 + len)
+        {
+            break;
+        }
+        int code = 0;
+        if (strncmp(head, "HTTP/1.", 7) == 0)
+        {
+            code = atoi(head + 9);
+        }
+        w->status[code >= 100 && code < 600 ? code / 100 : 0]++;
+        const char *conn_close = strcasestr(head, "\r\nConnection:");
+        if (conn_close && conn_close < c.in.c_str() + end && strncasecmp(conn_close + 13 + strspn(conn_close + 13, " "), "close", 5) == 0)
         {
-            return true;
+            close_after = true;
+        }
+        //连接建立之后才安排的第一个请求，从请求开始计时，连接空闲等待的时间不算
+        long first = c.opened;
+        if (!c.inflight.empty())
+        {
+            first = c.inflight.front() > c.opened ? c.inflight.front() : c.opened;
+            w->hist.record(now - c.inflight.front());
+            c.inflight.pop_front();
+        }
+        if (!c.answered)
+        {
+            w->connect_hist.record(now - first);
+            c.answered = true;
+        }
+        w->done++;
+        count++;
+        pos = end + 4 + len;
+        if (close_after)
+        {
+            break;
         }
     }
+    c.in.erase(0, pos);
+    return count;
 }
 
-void close_conn(int epfd, int fd)
+//开环模式：把到了计划时间的请求分给流水线未满的连接，都满了就留在backlog中
+static void dispatch_backlog(Worker *w)
 {
-    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
-    close(fd);
+    size_t n = w->conns.size();
+    size_t tried = 0;
+    while (!w->backlog.empty() && tried < n)
+    {
+        Conn &c = w->conns[w->rr];
+        w->rr = (w->rr + 1) % n;
+        if ((int)c.inflight.size() < opt.depth)
+        {
+            send_request(w, c, w->backlog.front());
+            w->backlog.pop_front();
+            tried = 0;
+        }
+        else
+        {
+            tried++;
+        }
+    }
 }
 
-int main(int argc, char const *argv[])
+static void handle_read(Worker *w, Conn &c, long now, char *buf)
 {
+    bool closed = false;
+    while (true)
+    {
+        int n = recv(c.fd, buf, BUFFERSIZE, 0);
+        if (n > 0)
+        {
+            w->bytes_in += n;
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN)
+        {
+            closed = true;
+        }
+        break;
+    }
+    bool close_after = false;
+    int completed = parse_responses(w, c, now, close_after);
+    if (closed || close_after)
+    {
+        //服务器按Connection: close关闭连接：尚未发出的请求留给新连接重发，不算错误
+        std::deque<long> pending;
+        if (close_after)
+        {
+            pending.swap(c.inflight);
+            c.out.clear();
+        }
+        reopen_conn(w, c);
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            send_request(w, c, pending[i]);
+        }
+        if (opt.rate == 0 && pending.empty())
+        {
+            for (int i = 0; i < opt.depth; i++)
+            {
+                send_request(w, c, now_ns());
+            }
+        }
+        return;
+    }
+    if (opt.rate == 0)
+    {
+        //闭环模式：完成几个就补发几个，在途请求数保持为流水线深度
+        for (int i = 0; i < completed; i++)
+        {
+            send_request(w, c, now_ns());
+        }
+    }
+}
 
-    int epfd = epoll_create(1);
-    //发送连接请求
-    start_conn(epfd, atoi(argv[3]), argv[1], atoi(argv[2]));
+//backlog不为空时所有连接的流水线都满了，由响应唤醒即可；否则在下一个计划发送时间唤醒
+static void arm_timer(Worker *w)
+{
+    if (!w->backlog.empty() || w->armed == w->next_send)
+    {
+        return;
+    }
+    w->armed = w->next_send;
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = w->next_send / 1000000000L;
+    its.it_value.tv_nsec = w->next_send % 1000000000L;
+    timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void *run(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    char *buf = new char[BUFFERSIZE];
     epoll_event events[MAX_EVENTS_NUM];
-    char buffer[BUFFERSIZE];
+    long start = now_ns();
+    long end = start + opt.duration * 1000000000L;
+    for (size_t i = 0; i < w->conns.size(); i++)
+    {
+        open_conn(w, w->conns[i]);
+        if (opt.rate == 0)
+        {
+            for (int d = 0; d < opt.depth; d++)
+            {
+                send_request(w, w->conns[i], start);
+            }
+        }
+    }
+    if (opt.rate > 0)
+    {
+        w->next_send = start;
+        w->armed = 0;
+        epoll_event ev;
+        ev.data.ptr = NULL;
+        ev.events = EPOLLIN;
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->timerfd, &ev);
+        arm_timer(w);
+    }
 
-    while (1)
+    while (true)
     {
-        int fds = epoll_wait(epfd, events, MAX_EVENTS_NUM, 2000);
-        for (size_t i = 0; i < fds; i++)
+        long now = now_ns();
+        if (now >= end)
         {
-            int sockfd = events[i].data.fd;
-            if (events[i].events & EPOLLOUT)
+            break;
+        }
+        int n = epoll_wait(w->epfd, events, MAX_EVENTS_NUM, (end - now) / 1000000 + 1);
+        now = now_ns();
+        for (int i = 0; i < n; i++)
+        {
+            Conn *c = (Conn *)events[i].data.ptr;
+            //开环模式的定时器：下面统一处理
+            if (!c)
+            {
+                uint64_t expirations;
+                if (read(w->timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                {
+                    perror("timerfd");
+                }
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN))
             {
-                //向服务器发送请求数据
-                if (!write_bytes(sockfd, request, strlen(request)))
+                reopen_conn(w, *c);
+                if (opt.rate == 0)
                 {
-                    close_conn(epfd, sockfd);
+                    for (int d = 0; d < opt.depth; d++)
+                    {
+                        send_request(w, *c, now);
+                    }
                 }
-                epoll_event ev;
-                ev.data.fd = sockfd;
-                ev.events = EPOLLIN | EPOLLET | EPOLLERR;
-                epoll_ctl(epfd, EPOLL_CTL_MOD, sockfd, &ev);
+                continue;
             }
-            else if (events[i].events & EPOLLIN)
+            if (events[i].events & EPOLLOUT)
             {
-                //从服务器读取数据
-                if (!read_once(sockfd, buffer, BUFFERSIZE))
+                c->connected = true;
+                if (!flush(w, *c))
                 {
-                    close_conn(epfd, sockfd);
+                    reopen_conn(w, *c);
+                    continue;
                 }
-                epoll_event ev;
-                ev.data.fd = sockfd;
-                ev.events = EPOLLOUT | EPOLLET | EPOLLERR;
-                epoll_ctl(epfd, EPOLL_CTL_MOD, sockfd, &ev);
             }
-            else if (events[i].events & EPOLLERR)
+            if (events[i].events & EPOLLIN)
+            {
+                handle_read(w, *c, now, buf);
+            }
+        }
+        if (opt.rate > 0)
+        {
+            //所有到了计划时间的请求进入backlog，延迟从计划时间算起，所以客户端排队的时间也计入
+            while (w->next_send <= now && w->next_send < end)
             {
-                close_conn(epfd, sockfd);
+                w->backlog.push_back(w->next_send);
+                w->next_send += w->interval;
             }
+            dispatch_backlog(w);
+            arm_timer(w);
         }
     }
+
+    if (opt.rate > 0)
+    {
+        /*结束时仍未完成的请求按已经等待的时间计入直方图（这是它们延迟的下限），
+        否则服务器卡住时，最慢的那些请求反而不会出现在统计中*/
+        for (size_t i = 0; i < w->backlog.size(); i++)
+        {
+            w->hist.record(end - w->backlog[i]);
+            w->unfinished++;
+        }
+        for (size_t i = 0; i < w->conns.size(); i++)
+        {
+            std::deque<long> &q = w->conns[i].inflight;
+            for (size_t k = 0; k < q.size(); k++)
+            {
+                w->hist.record(end - q[k]);
+                w->unfinished++;
+            }
+        }
+    }
+    for (size_t i = 0; i < w->conns.size(); i++)
+    {
+        close(w->conns[i].fd);
+    }
+    delete[] buf;
+    return w;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [options] host port\n", prog);
+    fprintf(stderr, "  -c conns     总连接数，默认100\n");
+    fprintf(stderr, "  -t threads   线程数，默认4\n");
+    fprintf(stderr, "  -d seconds   测试时长，默认10\n");
+    fprintf(stderr, "  -R rate      开环模式，按每秒rate个请求的固定速率发送；默认0为闭环模式\n");
+    fprintf(stderr, "  -p depth     每个连接的流水线深度，默认1\n");
+    fprintf(stderr, "  -k 0|1       是否使用长连接，默认1\n");
+    fprintf(stderr, "  -f mixfile   请求组合文件，每行\"[权重] 路径\"\n");
+    fprintf(stderr, "  -u path      不使用请求组合文件时请求的路径，默认/index.html\n");
+}
+
+static void print_latency(const char *name, unsigned long ns)
+{
+    printf("  %-6s %10.3f ms\n", name, ns / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "c:t:d:R:p:k:f:u:")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            opt.conns = atoi(optarg);
+            break;
+        case 't':
+            opt.threads = atoi(optarg);
+            break;
+        case 'd':
+            opt.duration = atoi(optarg);
+            break;
+        case 'R':
+            opt.rate = atof(optarg);
+            break;
+        case 'p':
+            opt.depth = atoi(optarg);
+            break;
+        case 'k':
+            opt.keepalive = atoi(optarg) != 0;
+            break;
+        case 'f':
+            opt.mix = optarg;
+            break;
+        case 'u':
+            opt.path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || opt.conns <= 0 || opt.threads <= 0 || opt.duration <= 0 || opt.rate < 0 || opt.depth <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    opt.host = argv[optind];
+    opt.port = atoi(argv[optind + 1]);
+    //不使用长连接时，每个连接只有一个请求，流水线没有意义
+    if (!opt.keepalive)
+    {
+        opt.depth = 1;
+    }
+    if (opt.threads > opt.conns)
+    {
+        opt.threads = opt.conns;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host, &server_addr.sin_addr) != 1)
+    {
+        struct hostent *he = gethostbyname(opt.host);
+        if (!he)
+        {
+            fprintf(stderr, "unknown host %s\n", opt.host);
+            return 1;
+        }
+        memcpy(&server_addr.sin_addr, he->h_addr, sizeof(server_addr.sin_addr));
+    }
+
+    if (opt.mix)
+    {
+        if (!load_mix(opt.mix))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        requests.push_back(build_request(opt.path));
+        weights.push_back(1);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Worker *> workers;
+    for (int i = 0; i < opt.threads; i++)
+    {
+        Worker *w = new Worker();
+        w->epfd = epoll_create(1);
+        w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        //连接数不能整除时，前面的线程各多一个
+        w->conns.resize(opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0));
+        w->interval = opt.rate > 0 ? 1e9 * opt.threads / opt.rate : 0;
+        w->seed = i + 1;
+        workers.push_back(w);
+    }
+    printf("%s %s:%d, %d connections, %d threads, %ds, pipeline %d, %s",
+           opt.rate > 0 ? "open-loop" : "closed-loop", opt.host, opt.port, opt.conns, opt.threads,
+           opt.duration, opt.depth, opt.keepalive ? "keep-alive" : "close");
+    if (opt.rate > 0)
+    {
+        printf(", target %.0f req/s", opt.rate);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        if (pthread_create(&workers[i]->tid, NULL, run, workers[i]) != 0)
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    Histogram hist, connect_hist;
+    long done = 0, errors = 0, unfinished = 0, bytes_in = 0, reconnects = 0;
+    long status[6] = {0};
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        Worker *w = workers[i];
+        pthread_join(w->tid, NULL);
+        hist.merge(w->hist);
+        connect_hist.merge(w->connect_hist);
+        done += w->done;
+        errors += w->errors;
+        unfinished += w->unfinished;
+        bytes_in += w->bytes_in;
+        reconnects += w->reconnects;
+        for (int k = 0; k < 6; k++)
+        {
+            status[k] += w->status[k];
+        }
+        close(w->epfd);
+        close(w->timerfd);
+        delete w;
+    }
+
+    printf("requests %ld, errors %ld, unfinished %ld, reconnects %ld\n", done, errors, unfinished, reconnects);
+    printf("throughput %.0f req/s, %.2f MB/s\n", (double)done / opt.duration, bytes_in / 1048576.0 / opt.duration);
+    printf("status 1xx %ld, 2xx %ld, 3xx %ld, 4xx %ld, 5xx %ld, invalid %ld\n",
+           status[1], status[2], status[3], status[4], status[5], status[0]);
+    printf("latency%s (mean %.3f ms)\n", opt.rate > 0 ? ", corrected for coordinated omission" : "", hist.mean() / 1e6);
+    print_latency("p50", hist.percentile(0.5));
+    print_latency("p90", hist.percentile(0.9));
+    print_latency("p99", hist.percentile(0.99));
+    print_latency("p99.9", hist.percentile(0.999));
+    print_latency("max", hist.max());
+    /*连接风暴下，服务器accept得慢或者监听队列溢出（SYN被丢弃后要等重传）都体现在这里*/
+    printf("new connection to first response (%lu connections, mean %.3f ms)\n", connect_hist.total(), connect_hist.mean() / 1e6);
+    print_latency("p50", connect_hist.percentile(0.5));
+    print_latency("p99", connect_hist.percentile(0.99));
+    print_latency("max", connect_hist.max());
     return 0;
-}
\ No newline at end of file
+}